@@ -378,6 +378,85 @@ void dictionary_dump(dictionary * d, FILE * out)
     return ;
 }
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Serialize a dictionary into a contiguous buffer.
+  @param    d       Dictionary to serialize.
+  @param    size    Size of the returned buffer in bytes (output).
+  @return   1 newly allocated buffer, NULL on allocation failure.
+
+  Each entry is stored as the key, a terminating zero, a flag character
+  ('v': value follows, 'n': NULL value) and the value with its
+  terminating zero. The buffer can be sent to other processes and turned
+  back into a dictionary with dictionary_deserialize(). The returned
+  buffer must be freed by the caller.
+ */
+/*--------------------------------------------------------------------------*/
+char * dictionary_serialize(dictionary * d, long * size)
+{
+    int     i ;
+    long    n = 0 ;
+    char *  buf ;
+    char *  p ;
+
+    for (i=0 ; d!=NULL && i<d->size ; i++) {
+        if (d->key[i]==NULL) continue ;
+        n += strlen(d->key[i]) + 2 ;
+        if (d->val[i]!=NULL) n += strlen(d->val[i]) + 1 ;
+    }
+    buf = (char *)malloc(n>0 ? n : 1);
+    if (buf==NULL) return NULL ;
+
+    p = buf ;
+    for (i=0 ; d!=NULL && i<d->size ; i++) {
+        if (d->key[i]==NULL) continue ;
+        strcpy(p, d->key[i]);
+        p += strlen(d->key[i]) + 1 ;
+        if (d->val[i]!=NULL) {
+            *p++ = 'v' ;
+            strcpy(p, d->val[i]);
+            p += strlen(d->val[i]) + 1 ;
+        } else {
+            *p++ = 'n' ;
+        }
+    }
+    *size = n ;
+    return buf ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Create a dictionary from a buffer of dictionary_serialize().
+  @param    buf     Serialized dictionary.
+  @param    size    Size of the buffer in bytes.
+  @return   1 newly allocated dictionary object.
+
+  The entries are inserted with dictionary_set(), in the order of the
+  serialized dictionary.
+ */
+/*--------------------------------------------------------------------------*/
+dictionary * dictionary_deserialize(const char * buf, long size)
+{
+    dictionary  *   d ;
+    const char  *   p = buf ;
+    const char  *   key ;
+
+    d = dictionary_new(0);
+    if (d==NULL) return NULL ;
+
+    while (p < buf + size) {
+        key = p ;
+        p += strlen(key) + 1 ;
+        if (*p++ == 'v') {
+            dictionary_set(d, key, p);
+            p += strlen(p) + 1 ;
+        } else {
+            dictionary_set(d, key, NULL);
+        }
+    }
+    return d ;
+}
+
 
 /* Test code */
 #ifdef TESTDIC
@@ -187,4 +187,28 @@ void dictionary_unset(dictionary * d, const char * key);
 /*--------------------------------------------------------------------------*/
 void dictionary_dump(dictionary * d, FILE * out);
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Serialize a dictionary into a contiguous buffer.
+  @param    d       Dictionary to serialize.
+  @param    size    Size of the returned buffer in bytes (output).
+  @return   1 newly allocated buffer, NULL on allocation failure.
+
+  The buffer can be sent to other processes and turned back into a
+  dictionary with dictionary_deserialize(). It must be freed by the
+  caller.
+ */
+/*--------------------------------------------------------------------------*/
+char * dictionary_serialize(dictionary * d, long * size);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Create a dictionary from a buffer of dictionary_serialize().
+  @param    buf     Serialized dictionary.
+  @param    size    Size of the buffer in bytes.
+  @return   1 newly allocated dictionary object.
+ */
+/*--------------------------------------------------------------------------*/
+dictionary * dictionary_deserialize(const char * buf, long size);
+
 #endif
@@ -32,12 +32,29 @@ enkf.h: Header file for global variables/ functions
 #define GLOBAL extern
 #endif
 
+/* bytes broadcast by the first MPI_Bcast of `enkf_bcast_bytes` */
+#define ENKF_BCAST_CHUNK 16384
+
 /* functions */
 void read_enkfpar(char *parname);
+char *enkf_read_file(char *filename, long *size);
+char *enkf_bcast_bytes(char *data, long *size, int root, MPI_Comm comm);
+void obs_prefetch_start(char *filename);
+void obs_prefetch_wait();
 void printstat_parflow();
-void printstat_param_parflow(double* dat, char* name, int dim);
+void printstat_parflow_finish();
+void printstat_parflow_pdaf(int* step, int* initial, double* mean, double* sd);
+void enkf_ensemblestatistics_ext(double* dat, int size, char* name, int cycle, int dim, MPI_Comm comm);
+void printstat_param_parflow_start(double* stat);
+void printstat_param_parflow(double* mean, double* sd, char* name, int cycle, int dim);
 void enkf_ensemblestatistics (double* dat, double* mean, double* var, int size, MPI_Comm comm);
+void enkf_ensemblestatistics_add(double* dat, double* mean, double* var, int size);
+void enkf_ensemblestatistics_start(MPI_Comm comm);
+void enkf_ensemblestatistics_wait();
+void enkf_ensemblestatistics_free();
+void enkf_welford_op(MPI_Datatype *type, MPI_Op *op);
 void enkf_printstatistics_pfb (double *dat, char* name, int cycle, char* prefix, int dim);
+void enkf_printensemble_pfb (double *dat, char* name, int cycle, int dim);
 extern void clm_init(char *s, int *pdaf_id, int *pdaf_max, int *mype);
 extern void clm_advance(int *ntstep, int *tstartcycle, int *mype);
 extern void update_clm(int *tstartcycle, int *mype);
@@ -101,12 +118,31 @@ GLOBAL int pf_olfmasking_depth;
 GLOBAL int pf_gwmasking;
 GLOBAL int pf_printgwmask;
 GLOBAL int pf_freq_paramupdate;
+GLOBAL int pf_zerocopy;
+GLOBAL int pf_paramclamp;
+GLOBAL int pf_output_queue;
+GLOBAL int pf_ensemble_output;
+GLOBAL int pf_output_precision;
+GLOBAL int pf_output_compression;
+GLOBAL int pf_checkpoint;
+GLOBAL int pf_restart;
+GLOBAL int pf_shared_static_input;
+#define ENKF_EXTSTAT_MAX 16
+GLOBAL int pf_extstat;
+GLOBAL int pf_extstat_exact;
+GLOBAL int pf_extstat_nquantiles;
+GLOBAL double pf_extstat_quantiles[ENKF_EXTSTAT_MAX];
+GLOBAL int pf_extstat_nthresholds;
+GLOBAL double pf_extstat_thresholds[ENKF_EXTSTAT_MAX];
+GLOBAL int restart_cycles;
 GLOBAL int pf_aniso_use_parflow;
 GLOBAL int is_dampfac_state_time_dependent;
 GLOBAL int is_dampfac_param_time_dependent;
 GLOBAL int pf_dampswitch_sm;
 GLOBAL int crns_flag;
 GLOBAL int da_print_obs_index;
+GLOBAL int da_obs_prefetch;
+GLOBAL int da_obs_cache;
 extern int model;
 extern int mype_model;
 extern int npes_model;
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------------------
+Copyright (c) 2013-2016 by Wolfgang Kurtz, Guowei He and Mukund Pondkule (Forschungszentrum Juelich GmbH)
+
+This file is part of TSMP-PDAF
+
+TSMP-PDAF is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TSMP-PDAF is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU LesserGeneral Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with TSMP-PDAF.  If not, see <http://www.gnu.org/licenses/>.
+-------------------------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------------------------------
+enkf_prefetch.c: Prefetch of the next observation file (`DA:obs_prefetch`)
+
+After the analysis, `next_observation_pdaf` knows the observation
+file of the next assimilation cycle. `obs_prefetch_start` reads this
+file in a background thread while the component models integrate, so
+that `read_obs_nc` finds it in the page cache of the node instead of
+waiting for the parallel file system.
+
+The thread only does POSIX I/O. netCDF is not thread-safe and is also
+used by the component models, so the file is decoded by `read_obs_nc`
+in the main thread when the observations are needed.
+-------------------------------------------------------------------------------------------*/
+#include "enkf.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* bytes read per call of `read` */
+#define ENKF_PREFETCH_CHUNK (4*1024*1024)
+
+static pthread_t prefetch_thread;
+static int       prefetch_running = 0;
+static char      prefetch_filename[600];
+static long long prefetch_bytes = 0;
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Prefetch thread: read `prefetch_filename` once.
+  @param    arg   Unused.
+  @return   NULL.
+
+  A missing file is not an error here, `read_obs_nc` reports it.
+ */
+/*--------------------------------------------------------------------------*/
+static void *obs_prefetch_run(void *arg)
+{
+  char *buf;
+  ssize_t n;
+  int fd;
+  (void) arg;
+
+  prefetch_bytes = 0;
+  fd = open(prefetch_filename, O_RDONLY);
+  if(fd < 0) return NULL;
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  buf = (char*) malloc(ENKF_PREFETCH_CHUNK);
+  if(buf != NULL){
+    while((n = read(fd, buf, ENKF_PREFETCH_CHUNK)) > 0) prefetch_bytes += n;
+    free(buf);
+  }
+  close(fd);
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Wait for a running prefetch.
+ */
+/*--------------------------------------------------------------------------*/
+void obs_prefetch_wait()
+{
+  if(!prefetch_running) return;
+
+  pthread_join(prefetch_thread, NULL);
+  prefetch_running = 0;
+  if(screen_wrapper > 1){
+    printf("TSMP-PDAF-WRAPPER mype(w)=%5d: prefetched %lld bytes of %s\n", mype_world, prefetch_bytes, prefetch_filename);
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Start reading an observation file in the background.
+  @param    filename   Name of the observation file (zero-terminated).
+
+  Waits for a previous prefetch first. Without `DA:obs_prefetch` or
+  if the thread cannot be started, nothing is prefetched.
+ */
+/*--------------------------------------------------------------------------*/
+void obs_prefetch_start(char *filename)
+{
+  if(!da_obs_prefetch) return;
+
+  obs_prefetch_wait();
+
+  strncpy(prefetch_filename, filename, sizeof(prefetch_filename) - 1);
+  prefetch_filename[sizeof(prefetch_filename) - 1] = '\0';
+  if(pthread_create(&prefetch_thread, NULL, obs_prefetch_run, NULL) == 0){
+    prefetch_running = 1;
+  }
+}
@@ -25,15 +25,147 @@ read_enkfpar.c: Function for reading controle file of TSMP-PDAF
 #include "enkf.h"
 #include "iniparser.h"
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Parse a list of numbers from the input file.
+  @param    string   Numbers separated by commas or blanks.
+  @param    values   Parsed numbers (output, at most `max`).
+  @param    max      Maximum number of values.
+  @param    key      Key in the input file (error message).
+  @return   Number of values.
+ */
+/*--------------------------------------------------------------------------*/
+static int read_enkfpar_list(char *string, double *values, int max, char *key)
+{
+  int n = 0;
+  char *end;
+
+  while(*string != '\0'){
+    if(*string == ',' || *string == ' ' || *string == '\t'){
+      string++;
+      continue;
+    }
+    if(n == max){
+      printf("Error: more than %d values in %s.\n", max, key);
+      exit(1);
+    }
+    values[n] = strtod(string, &end);
+    if(end == string){
+      printf("Error: could not read %s: %s\n", key, string);
+      exit(1);
+    }
+    string = end;
+    n++;
+  }
+  return n;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Read a whole file into memory.
+  @param    filename   Name of the file.
+  @param    size       Size of the file in bytes (output).
+  @return   Newly allocated buffer (zero-terminated), NULL if the file
+            cannot be read.
+ */
+/*--------------------------------------------------------------------------*/
+char *enkf_read_file(char *filename, long *size)
+{
+  FILE *f;
+  char *buf;
+
+  f = fopen(filename,"rb");
+  if(f == NULL) return NULL;
+  fseek(f,0,SEEK_END);
+  *size = ftell(f);
+  fseek(f,0,SEEK_SET);
+  buf = (char*) malloc(*size + 1);
+  if(buf == NULL || (long) fread(buf,1,*size,f) != *size){
+    free(buf);
+    fclose(f);
+    return NULL;
+  }
+  buf[*size] = '\0';
+  fclose(f);
+  return buf;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Broadcast a buffer of bytes (small per-run input).
+  @param    data   Buffer on `root` (NULL: input not available), ignored
+                   on the other ranks.
+  @param    size   Size of `data` on `root`, set on the other ranks.
+  @param    root   Rank of the sending process in `comm`.
+  @param    comm   Communicator.
+  @return   `data` on `root`, a newly allocated zero-terminated copy on
+            the other ranks, NULL on all ranks if `data` is NULL on
+            `root`.
+
+  Buffers up to ENKF_BCAST_CHUNK bytes (size included) need a single
+  `MPI_Bcast`, larger ones a second one for the remainder.
+ */
+/*--------------------------------------------------------------------------*/
+char *enkf_bcast_bytes(char *data, long *size, int root, MPI_Comm comm)
+{
+  char chunk[ENKF_BCAST_CHUNK];
+  long payload = ENKF_BCAST_CHUNK - (long) sizeof(long);
+  long n;
+  char *buf;
+  int rank;
+
+  MPI_Comm_rank(comm,&rank);
+  if(rank == root){
+    n = data == NULL ? -1 : *size;
+    memcpy(chunk,&n,sizeof(long));
+    if(n > 0) memcpy(chunk + sizeof(long),data,n < payload ? n : payload);
+  }
+
+  MPI_Bcast(chunk,ENKF_BCAST_CHUNK,MPI_CHAR,root,comm);
+  memcpy(&n,chunk,sizeof(long));
+  if(n < 0) return NULL;
+
+  if(rank == root){
+    buf = data;
+  }else{
+    buf = (char*) malloc(n + 1);
+    if(buf == NULL){
+      printf("Error: could not allocate %ld bytes for broadcast input\n",n);
+      exit(1);
+    }
+    memcpy(buf,chunk + sizeof(long),n < payload ? n : payload);
+    buf[n] = '\0';
+    *size = n;
+  }
+  if(n > payload){
+    MPI_Bcast(buf + payload,(int)(n - payload),MPI_CHAR,root,comm);
+  }
+  return buf;
+}
+
 void read_enkfpar(char *parname)
 {
   char *string;
   dictionary *pardict;
 
   int coupcol;
+  int i;
  
-  /* initialize dictionary */
-  pardict = iniparser_load(parname);
+  /* initialize dictionary: parsed on world rank 0, broadcast as
+     serialized dictionary */
+  {
+    char *buf = NULL;
+    long size = 0;
+    if(mype_world == 0){
+      pardict = iniparser_load(parname);
+      if(pardict != NULL) buf = dictionary_serialize(pardict,&size);
+    }
+    buf = enkf_bcast_bytes(buf,&size,0,MPI_COMM_WORLD);
+    if(mype_world != 0){
+      pardict = buf != NULL ? dictionary_deserialize(buf,size) : NULL;
+    }
+    free(buf);
+  }
  
   /* get settings for ParFlow */
   string                = iniparser_getstring(pardict,"PF:problemname", "");
@@ -65,6 +197,21 @@ void read_enkfpar(char *parname)
   pf_dampfac_state      = iniparser_getdouble(pardict,"PF:dampingfactor_state",1.0);
   pf_dampswitch_sm        = iniparser_getdouble(pardict,"PF:damping_switch_sm",0);
   pf_freq_paramupdate   = iniparser_getint(pardict,"PF:paramupdate_frequency",1);
+  pf_zerocopy           = iniparser_getint(pardict,"PF:zerocopy",0);
+  pf_paramclamp         = iniparser_getint(pardict,"PF:paramclamp",0);
+  pf_output_queue       = iniparser_getint(pardict,"PF:output_queue",0);
+  pf_ensemble_output    = iniparser_getint(pardict,"PF:ensemble_output",0);
+  pf_output_precision   = iniparser_getint(pardict,"PF:output_precision",64);
+  pf_output_compression = iniparser_getint(pardict,"PF:output_compression",0);
+  pf_checkpoint         = iniparser_getint(pardict,"PF:checkpoint",0);
+  pf_restart            = iniparser_getint(pardict,"PF:restart",0);
+  pf_shared_static_input = iniparser_getint(pardict,"PF:shared_static_input",0);
+  pf_extstat            = iniparser_getint(pardict,"PF:extstat",0);
+  pf_extstat_exact      = iniparser_getint(pardict,"PF:extstat_exact",64);
+  string                = iniparser_getstring(pardict,"PF:extstat_quantiles","");
+  pf_extstat_nquantiles = read_enkfpar_list(string,pf_extstat_quantiles,ENKF_EXTSTAT_MAX,"PF:extstat_quantiles");
+  string                = iniparser_getstring(pardict,"PF:extstat_thresholds","");
+  pf_extstat_nthresholds = read_enkfpar_list(string,pf_extstat_thresholds,ENKF_EXTSTAT_MAX,"PF:extstat_thresholds");
 
   /* backward compatibility settings for ParFlow */
   if (t_sim == 0){
@@ -103,6 +250,8 @@ void read_enkfpar(char *parname)
   crns_flag             = iniparser_getint(pardict,"DA:crns_flag",0);
   da_crns_depth_tol     = iniparser_getdouble(pardict,"DA:da_crns_depth_tol",0.01);
   da_print_obs_index    = iniparser_getint(pardict,"DA:print_obs_index",0);
+  da_obs_prefetch       = iniparser_getint(pardict,"DA:obs_prefetch",0);
+  da_obs_cache          = iniparser_getint(pardict,"DA:obs_cache",0);
   total_steps = (int) (t_sim/da_interval);
   tstartcycle = (int) (t_start/da_interval);
 
@@ -131,6 +280,74 @@ void read_enkfpar(char *parname)
     exit(1);
   }
 
+  /* Check: `pf_zerocopy` only covers plain state updates */
+  /*        (no parameters, no groundwater/river masking) */
+  if (pf_zerocopy == 1 && (pf_paramupdate != 0 || pf_gwmasking != 0 || pf_olfmasking == 2)){
+    printf("pf_zerocopy=%d\n", pf_zerocopy);
+    printf("pf_paramupdate=%d\n", pf_paramupdate);
+    printf("pf_gwmasking=%d\n", pf_gwmasking);
+    printf("pf_olfmasking=%d\n", pf_olfmasking);
+    printf("Error: PF:zerocopy=1 requires PF:paramupdate=0, PF:gwmasking=0 and PF:olfmasking!=2.\n");
+    exit(1);
+  }
+
+  /* Check: `pf_output_queue` is the number of queued outputs */
+  if (pf_output_queue < 0){
+    printf("pf_output_queue=%d\n", pf_output_queue);
+    printf("Error: PF:output_queue must be non-negative.\n");
+    exit(1);
+  }
+
+  /* Check: `pf_printstat` (2: statistics from the PDAF ensemble) */
+  if (pf_printstat < 0 || pf_printstat > 2){
+    printf("pf_printstat=%d\n", pf_printstat);
+    printf("Error: PF:printstat must be 0, 1 or 2.\n");
+    exit(1);
+  }
+
+  /* Check: extended ensemble statistics */
+  if (pf_extstat != 0 && pf_extstat != 1){
+    printf("pf_extstat=%d\n", pf_extstat);
+    printf("Error: PF:extstat must be 0 or 1.\n");
+    exit(1);
+  }
+  for (i = 0; i < pf_extstat_nquantiles; i++){
+    if (pf_extstat_quantiles[i] <= 0.0 || pf_extstat_quantiles[i] >= 1.0){
+      printf("pf_extstat_quantiles[%d]=%lf\n", i, pf_extstat_quantiles[i]);
+      printf("Error: PF:extstat_quantiles must be in (0,1).\n");
+      exit(1);
+    }
+  }
+
+  /* Check: `pf_ensemble_output` */
+  if (pf_ensemble_output < 0 || pf_ensemble_output > 2){
+    printf("pf_ensemble_output=%d\n", pf_ensemble_output);
+    printf("Error: PF:ensemble_output must be 0, 1 or 2.\n");
+    exit(1);
+  }
+
+  /* Check: `pf_restart` only restores ParFlow, the restart time of
+     CLM and COSMO is not checked against the checkpoint */
+#ifndef PARFLOW_STAND_ALONE
+  if (pf_restart){
+    printf("pf_restart=%d\n", pf_restart);
+    printf("Error: PF:restart is only available in ParFlow stand-alone builds.\n");
+    exit(1);
+  }
+#endif
+
+  /* Check: output encoding */
+  if (pf_output_precision != 64 && pf_output_precision != 32 && pf_output_precision != 16){
+    printf("pf_output_precision=%d\n", pf_output_precision);
+    printf("Error: PF:output_precision must be 64, 32 or 16.\n");
+    exit(1);
+  }
+  if (pf_output_compression != 0 && pf_output_compression != 1){
+    printf("pf_output_compression=%d\n", pf_output_compression);
+    printf("Error: PF:output_compression must be 0 or 1.\n");
+    exit(1);
+  }
+
   /* Check: `npes_model = nprocpf + nprocclm + npproccosmo */
   if (nprocpf + nprocclm + nproccosmo != npes_model){
     printf("nprocpf=%d\n", nprocpf);
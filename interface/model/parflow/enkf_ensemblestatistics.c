@@ -27,14 +27,15 @@ enkf_ensemblestatistics.c: Functions for calculating ensemble statistics for Par
 #include <math.h>
 
 
-void printstat_parflow()
-{
-  MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
+/* statistics packed for the next reduction: state of `printstat_parflow`,
+   parameter blocks of `printstat_param_parflow_start` */
+static int stat_pending = 0;
+static int stat_cycle;
+static int param_stat_pending = 0;
+static int param_stat_cycle;
 
-  int cycle = tstartcycle + stat_dumpoffset;
-  cycle++;
-
-  enkf_ensemblestatistics(pf_statevec,subvec_mean,subvec_sd,enkf_subvecsize,comm_couple_c);
+static void printstat_parflow_print(int cycle)
+{
   if(task_id==1 && pf_updateflag==1){
     enkf_printstatistics_pfb(subvec_mean,"press.mean",cycle,pfoutfile_stat,3);
     enkf_printstatistics_pfb(subvec_sd,"press.sd",cycle,pfoutfile_stat,3);
@@ -45,63 +46,674 @@ void printstat_parflow()
   }
 }
 
-void printstat_param_parflow(double* dat, char* name, int dim)
+void printstat_parflow()
 {
   MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
 
-  enkf_ensemblestatistics(dat,subvec_param_mean,subvec_param_sd,pf_paramvecsize,comm_couple_c);
+  int cycle = tstartcycle + stat_dumpoffset;
+  cycle++;
+
+  /* zero-copy: no `pf_statevec`, snapshot of the first state field */
+  double *dat = pf_statevec;
+  if(pf_zerocopy) dat = enkf_parflow_snapshot(pf_updateflag == 1);
+
+  printstat_parflow_finish();
+
+  /* min/max, higher moments, quantiles, exceedance probabilities */
+  if(pf_extstat){
+    enkf_ensemblestatistics_ext(dat,enkf_subvecsize,pf_updateflag==1 ? "press" : "swc",cycle,3,comm_couple_c);
+  }
+
+  /* PF:gwmasking=2: statistics already reduced with the saturation
+     sums in `enkfparflowadvance` */
+  if(stat_precomputed){
+    stat_precomputed = 0;
+    printstat_parflow_print(cycle);
+    return;
+  }
+
+  enkf_ensemblestatistics_add(dat,subvec_mean,subvec_sd,enkf_subvecsize);
+  stat_pending = 1;
+  stat_cycle = cycle;
+
+  /* With parameter statistics in the next `update_parflow` (same
+     condition as `do_pupd` there, `tstartcycle` is incremented after
+     this call), the state is reduced together with the parameters.
+     Otherwise the reduction runs during the assimilation. */
+  if(!(pf_paramupdate > 0 && pf_paramprintstat && (tstartcycle + 1) % pf_freq_paramupdate == 0)){
+    enkf_ensemblestatistics_start(comm_couple_c);
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Pack the parameter blocks for the statistics reduction and
+            start it.
+  @param[in]   double* stat Damped (transformed) parameter values of this member,
+                            layout of the parameter part of the state vector.
+
+  The reduction also contains the state statistics of the last
+  `printstat_parflow`, if pending. It is completed, and all statistics
+  are printed, in `printstat_parflow_finish`.
+ */
+/*--------------------------------------------------------------------------*/
+void printstat_param_parflow_start(double* stat)
+{
+  MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
+  int poff = pf_statevecsize - pf_paramvecsize;
+  int b;
+
+  for(b=pf_nstateblocks;b<pf_nblocks;b++){
+    int off = pf_blocks[b].offset - poff;
+    enkf_ensemblestatistics_add(&stat[off],&subvec_param_mean[off],&subvec_param_sd[off],pf_blocks[b].size);
+  }
+  enkf_ensemblestatistics_start(comm_couple_c);
+  param_stat_pending = 1;
+  param_stat_cycle = tstartcycle + stat_dumpoffset;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Complete the pending statistics reduction and print the
+            statistics of the state and the parameter blocks.
+
+  Does nothing if no statistics are pending.
+ */
+/*--------------------------------------------------------------------------*/
+void printstat_parflow_finish()
+{
+  int b;
+
+  if(!stat_pending && !param_stat_pending) return;
+
+  enkf_ensemblestatistics_start(MPI_Comm_f2c(comm_couple));
+  enkf_ensemblestatistics_wait();
+
+  if(stat_pending){
+    stat_pending = 0;
+    printstat_parflow_print(stat_cycle);
+  }
+  if(param_stat_pending){
+    int poff = pf_statevecsize - pf_paramvecsize;
+    param_stat_pending = 0;
+    for(b=pf_nstateblocks;b<pf_nblocks;b++){
+      char name[100];
+      int off = pf_blocks[b].offset - poff;
+      sprintf(name,"param.%s",pf_blocks[b].name);
+      printstat_param_parflow(&subvec_param_mean[off],&subvec_param_sd[off],name,param_stat_cycle,pf_blocks[b].dim);
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Print ensemble statistics computed from the PDAF ensemble
+  @param[in]   int* step PDAF time step (negative: forecast, else analysis)
+  @param[in]   int* initial 1 for the initial ensemble
+  @param[in]   double* mean PE-local ensemble mean (layout of the state vector)
+  @param[in]   double* sd PE-local ensemble standard deviation
+
+  `PF:printstat = 2`: called on the filter PEs from
+  `prepoststep_ens_pdaf`, which holds the full ensemble, so no
+  reduction over `comm_couple` is needed. One file per block of the
+  state vector, e.g. `press.for.mean`, `param.ksat.ana.sd`.
+ */
+/*--------------------------------------------------------------------------*/
+void printstat_parflow_pdaf(int* step, int* initial, double* mean, double* sd)
+{
+  char name[100];
+  char *tag = *step < 0 ? "for" : "ana";
+  int cycle = tstartcycle + stat_dumpoffset;
+  int b;
+
+  if(*initial) tag = "ini";
+
+  for(b=0;b<pf_nblocks;b++){
+    enkf_block *block = &pf_blocks[b];
+    char *kind = b < pf_nstateblocks ? "" : "param.";
+
+    sprintf(name,"%s%s.%s.mean",kind,block->name,tag);
+    enkf_printstatistics_pfb(&mean[block->offset],name,cycle,pfoutfile_stat,block->dim);
+    sprintf(name,"%s%s.%s.sd",kind,block->name,tag);
+    enkf_printstatistics_pfb(&sd[block->offset],name,cycle,pfoutfile_stat,block->dim);
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Print ensemble statistics of a parameter block
+  @param[in]   double* mean Ensemble mean of the parameter block (valid on `task_id==1`)
+  @param[in]   double* sd Ensemble standard deviation of the parameter block (valid on `task_id==1`)
+  @param[in]   char* name Name of the output file.
+  @param[in]   int cycle Number used as suffix.
+  @param[in]   int dim Number of dimensions of the parameter block.
+ */
+/*--------------------------------------------------------------------------*/
+void printstat_param_parflow(double* mean, double* sd, char* name, int cycle, int dim)
+{
   if(task_id==1){
     char name_mean[100];
     char name_sd[100];
-    int cycle = tstartcycle + stat_dumpoffset;
+
     sprintf(name_mean,"%s.%s",name,"mean");
     sprintf(name_sd,"%s.%s",name,"sd");
-    enkf_printstatistics_pfb(subvec_param_mean,name_mean,cycle,pfoutfile_stat,dim);
-    enkf_printstatistics_pfb(subvec_param_sd,name_sd,cycle,pfoutfile_stat,dim);
+    enkf_printstatistics_pfb(mean,name_mean,cycle,pfoutfile_stat,dim);
+    enkf_printstatistics_pfb(sd,name_sd,cycle,pfoutfile_stat,dim);
+  }
+}
+
+/* persistent buffer and MPI objects of the statistics reduction, fields
+   packed by `enkf_ensemblestatistics_add` */
+#define ENKF_STAT_MAX_FIELDS 16
+static double *stat_pack = NULL;
+static int stat_capacity = 0;
+static int stat_size = 0;
+static int stat_nfields = 0;
+static double *stat_mean[ENKF_STAT_MAX_FIELDS];
+static double *stat_var[ENKF_STAT_MAX_FIELDS];
+static int stat_fsize[ENKF_STAT_MAX_FIELDS];
+static int stat_started = 0;
+static int stat_root = 0;
+static MPI_Request stat_request = MPI_REQUEST_NULL;
+static MPI_Datatype stat_type = MPI_DATATYPE_NULL;
+static MPI_Op stat_op = MPI_OP_NULL;
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    MPI reduction operator merging Welford partials.
+  @param[in]      void* in Partials (count, mean, M2) per cell.
+  @param[in,out]  void* inout Partials, merged with `in`.
+  @param[in]      int* len Number of cells.
+  @param[in]      MPI_Datatype* type Datatype of one cell (unused).
+
+  Pairwise update of Chan et al.: the mean difference of the two
+  partials corrects the sum of squared deviations `M2`.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_welford_merge(void *in, void *inout, int *len, MPI_Datatype *type)
+{
+  int i;
+  double *a = (double*) in;
+  double *b = (double*) inout;
+
+  for(i=0;i<*len;i++){
+    double na = a[3*i], nb = b[3*i];
+    double n = na + nb;
+    double delta;
+
+    if(na == 0.0) continue;
+    delta = a[3*i+1] - b[3*i+1];
+    b[3*i]    = n;
+    b[3*i+1] += delta * na / n;
+    b[3*i+2] += a[3*i+2] + delta * delta * na * nb / n;
   }
 }
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    MPI datatype and operator for Welford partials.
+  @param[out]   MPI_Datatype* type One cell (count, mean, M2).
+  @param[out]   MPI_Op* op Merge of partials (`enkf_welford_merge`).
+
+  Created on the first call, freed by `enkf_ensemblestatistics_free`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_welford_op(MPI_Datatype *type, MPI_Op *op)
+{
+  if(stat_op == MPI_OP_NULL){
+    MPI_Type_contiguous(3,MPI_DOUBLE,&stat_type);
+    MPI_Type_commit(&stat_type);
+    MPI_Op_create(enkf_welford_merge,1,&stat_op);
+  }
+  *type = stat_type;
+  *op = stat_op;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Add a field to the next ensemble statistics reduction.
+  @param[in]    double* dat Input vector (ensembles distributed across the communicator)
+  @param[out]   double* mean Mean vector of the ensemble, set by `enkf_ensemblestatistics_wait`
+  @param[out]   double* var Standard deviation vector of the ensemble, set by `enkf_ensemblestatistics_wait`
+  @param[in]    int size Size of `mean`, `var` and a single realization `dat`
+
+  Packs the Welford partials of `dat` (count 1, mean `dat`, M2 0) into
+  a persistent buffer, `dat` may be modified after the call. The
+  buffer only grows, no allocation once it is large enough.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_ensemblestatistics_add(double* dat, double* mean, double* var, int size)
+{
+  int i;
+  double *pack;
+
+  if(stat_started){
+    printf("Error: enkf_ensemblestatistics_add called during a pending reduction\n");
+    exit(1);
+  }
+  if(stat_nfields == ENKF_STAT_MAX_FIELDS){
+    printf("Error: more than %d fields in ensemble statistics\n",ENKF_STAT_MAX_FIELDS);
+    exit(1);
+  }
+  if(stat_size + size > stat_capacity){
+    stat_capacity = stat_size + size;
+    stat_pack = (double*) realloc(stat_pack,3*(size_t)stat_capacity*sizeof(double));
+    if(stat_pack == NULL){
+      printf("Error: could not allocate buffer for ensemble statistics (size %d)\n",stat_capacity);
+      exit(1);
+    }
+  }
+
+  pack = stat_pack + 3*(size_t)stat_size;
+  for(i=0;i<size;i++){
+    pack[3*i]   = 1.0;
+    pack[3*i+1] = dat[i];
+    pack[3*i+2] = 0.0;
+  }
+
+  stat_mean[stat_nfields]  = mean;
+  stat_var[stat_nfields]   = var;
+  stat_fsize[stat_nfields] = size;
+  stat_nfields++;
+  stat_size += size;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Start the reduction of all added fields (non-blocking).
+  @param[in]    MPI_Comm comm Communicator for MPI-reduction-operation
+
+  One `MPI_Ireduce` to rank 0 of `comm` for all fields. Does nothing
+  if the reduction is already started. Completed by
+  `enkf_ensemblestatistics_wait`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_ensemblestatistics_start(MPI_Comm comm)
+{
+  int rank;
+
+  if(stat_started || stat_nfields == 0) return;
+
+  enkf_welford_op(&stat_type,&stat_op);
+
+  MPI_Comm_rank(comm,&rank);
+  stat_root = rank == 0;
+  if(stat_root){
+    MPI_Ireduce(MPI_IN_PLACE,stat_pack,stat_size,stat_type,stat_op,0,comm,&stat_request);
+  }else{
+    MPI_Ireduce(stat_pack,NULL,stat_size,stat_type,stat_op,0,comm,&stat_request);
+  }
+  stat_started = 1;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Complete the reduction of `enkf_ensemblestatistics_start`.
+
+  Sets mean and standard deviation of all added fields (only on rank 0
+  of the communicator) and empties the list of fields.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_ensemblestatistics_wait()
+{
+  int f, i;
+  double *pack = stat_pack;
+
+  if(!stat_started) return;
+
+  MPI_Wait(&stat_request,MPI_STATUS_IGNORE);
+
+  if(stat_root){
+    for(f=0;f<stat_nfields;f++){
+      for(i=0;i<stat_fsize[f];i++){
+        stat_mean[f][i] = pack[3*i+1];
+        stat_var[f][i]  = sqrt(pack[3*i+2] / (pack[3*i] - 1.0));
+      }
+      pack += 3*(size_t)stat_fsize[f];
+    }
+  }
+
+  stat_nfields = 0;
+  stat_size = 0;
+  stat_started = 0;
+}
+
 /*-------------------------------------------------------------------------*/
 /**
   @author   Wolfgang Kurtz, Guowei He
   @brief    Compute ensemble statistics
   @param[in]    double* dat Input vector (ensembles distributed across `comm`)
   @param[out]   double* mean Mean vector of ensemble `dat` computed in this routine
-  @param[out]   double* var Variance vector of ensemble `dat` computed in this routine
+  @param[out]   double* var Standard deviation vector of ensemble `dat` computed in this routine
   @param[in]    int size Size of `mean`, `var` and a single realization `dat`
   @param[in]    MPI_Comm comm Communicator for MPI-reduction-operation
 
-  1. Sum up ensemble members from different PEs (`MPI_Allreduce`)
-  2. Normalize sums to obtain mean; compute variance summands
-  3. Sum up variance summands (`MPI_Reduce`)
-  4. Normalize variance sums to obtain variance
+  Blocking single-field version of `enkf_ensemblestatistics_add` /
+  `_start` / `_wait`: one reduction of Welford partials (count, mean,
+  M2). Fields added before and not yet reduced are included.
+
+  `mean` and `var` are only computed on rank 0 of `comm`.
  */
 /*--------------------------------------------------------------------------*/
 void enkf_ensemblestatistics (double* dat, double* mean, double* var, int size, MPI_Comm comm)
 {
-  int i;
-  double *varsum;
+  enkf_ensemblestatistics_wait();
+  enkf_ensemblestatistics_add(dat,mean,var,size);
+  enkf_ensemblestatistics_start(comm);
+  enkf_ensemblestatistics_wait();
+}
 
-  varsum = (double*) calloc(size,sizeof(double));
+/* extended statistics (`PF:extstat`): partials of the moment sketch
+   are (count, mean, M2, M3, M4, min, max, exceedance counts) */
+#define ENKF_EXT_PARTIAL 7
+static int ext_width = 0;
+static double *ext_buf = NULL;
+static size_t ext_capacity = 0;
+static double *ext_out = NULL;
+static size_t ext_out_capacity = 0;
+static MPI_Datatype ext_type = MPI_DATATYPE_NULL;
+static MPI_Op ext_op = MPI_OP_NULL;
 
-  /* 1. Sum of ensemble members */
-  MPI_Allreduce(dat,mean,size,MPI_DOUBLE,MPI_SUM,comm);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    MPI reduction operator merging partials of the moment sketch.
+  @param[in]      void* in Partials per cell (`ext_width` values).
+  @param[in,out]  void* inout Partials, merged with `in`.
+  @param[in]      int* len Number of cells.
+  @param[in]      MPI_Datatype* type Datatype of one cell (unused).
 
-  for(i=0;i<size;i++){
-      /* 2. Normalize sum to obtain mean */
-      mean[i] = mean[i] / nreal;
-      /* 2. Compute variance summands */
-      var[i]  = (dat[i] - mean[i]) * (dat[i] - mean[i]);
+  Pairwise update of the central moments up to fourth order (Pebay
+  2008), minimum, maximum and sum of the exceedance counts.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_ext_merge(void *in, void *inout, int *len, MPI_Datatype *type)
+{
+  int i, t;
+  double *a = (double*) in;
+  double *b = (double*) inout;
+
+  for(i=0;i<*len;i++, a+=ext_width, b+=ext_width){
+    double na = a[0], nb = b[0];
+    double n = na + nb;
+    double d, d2, m2, m3;
+
+    if(na == 0.0) continue;
+    d  = a[1] - b[1];
+    d2 = d * d;
+    m2 = b[2];
+    m3 = b[3];
+
+    b[0] = n;
+    b[1] = b[1] + d * na / n;
+    b[2] = a[2] + m2 + d2 * na * nb / n;
+    b[3] = a[3] + m3 + d2 * d * na * nb * (nb - na) / (n * n)
+         + 3.0 * d * (nb * a[2] - na * m2) / n;
+    b[4] = a[4] + b[4] + d2 * d2 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n)
+         + 6.0 * d2 * (nb * nb * a[2] + na * na * m2) / (n * n)
+         + 4.0 * d * (nb * a[3] - na * m3) / n;
+    if(a[5] < b[5]) b[5] = a[5];
+    if(a[6] > b[6]) b[6] = a[6];
+    for(t=ENKF_EXT_PARTIAL;t<ext_width;t++) b[t] += a[t];
   }
+}
 
-  //MPI_Allreduce(MPI_IN_PLACE,var,size,MPI_DOUBLE,MPI_SUM,comm);
-  /* 3. Sum up variance summands */
-  MPI_Reduce(var,varsum,size,MPI_DOUBLE,MPI_SUM,0,comm);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Quantile of the standard normal distribution.
+  @param    p   Probability in (0,1).
+  @return   `z` with `Phi(z) = p` (rational approximation of Acklam,
+            relative error below 1.2e-9).
+ */
+/*--------------------------------------------------------------------------*/
+static double enkf_normal_quantile(double p)
+{
+  static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                              1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                              6.680131188771972e+01, -1.328068155288572e+01};
+  static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                              -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                              3.754408661907416e+00};
+  double q, r;
 
-  /* 4. Normalize variance sums to obtain variance */
-  for(i=0;i<size;i++) var[i] = sqrt(varsum[i] / (nreal-1));
+  if(p < 0.02425){
+    q = sqrt(-2.0 * log(p));
+    return (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+  }
+  if(p > 1.0 - 0.02425){
+    q = sqrt(-2.0 * log(1.0 - p));
+    return -(((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) / ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1.0);
+  }
+  q = p - 0.5;
+  r = q * q;
+  return (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q / (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1.0);
+}
 
-  free(varsum);
+static int enkf_compare_double(const void *a, const void *b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Extended ensemble statistics from the sorted members of a cell.
+  @param[in]    double* x Sorted member values.
+  @param[in]    int n Number of members.
+  @param[out]   double* out Products of the cell (stride `size`).
+  @param[in]    int size Number of cells.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_ext_exact(double *x, int n, double *out, int size)
+{
+  int k, t;
+  double mean = 0.0, m2 = 0.0, m3 = 0.0, m4 = 0.0;
+
+  for(k=0;k<n;k++) mean += x[k];
+  mean /= n;
+  for(k=0;k<n;k++){
+    double d = x[k] - mean, d2 = d * d;
+    m2 += d2;
+    m3 += d2 * d;
+    m4 += d2 * d2;
+  }
+  m2 /= n; m3 /= n; m4 /= n;
+
+  out[0]      = x[0];
+  out[size]   = x[n-1];
+  out[2*size] = m2 > 0.0 ? m3 / (m2 * sqrt(m2)) : 0.0;
+  out[3*size] = m2 > 0.0 ? m4 / (m2 * m2) - 3.0 : 0.0;
+
+  /* quantiles: linear interpolation of the order statistics */
+  for(k=0;k<pf_extstat_nquantiles;k++){
+    double h = (n - 1) * pf_extstat_quantiles[k];
+    int lo = (int) h;
+    double v = x[lo];
+    if(lo + 1 < n) v += (h - lo) * (x[lo+1] - x[lo]);
+    out[(4+k)*size] = v;
+  }
+  for(t=0;t<pf_extstat_nthresholds;t++){
+    int cnt = 0;
+    for(k=0;k<n;k++) if(x[k] > pf_extstat_thresholds[t]) cnt++;
+    out[(4+pf_extstat_nquantiles+t)*size] = (double) cnt / n;
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Extended ensemble statistics, written per cycle.
+  @param[in]   double* dat Input vector (ensembles distributed across `comm`)
+  @param[in]   int size Size of a single realization `dat`
+  @param[in]   char* name Name of the field (file `<name>.min` etc.)
+  @param[in]   int cycle Number used as suffix.
+  @param[in]   int dim Number of dimensions of `dat`.
+  @param[in]   MPI_Comm comm Communicator for MPI-reduction-operation
+
+  Products `min`, `max`, `skew`, `kurt` (excess kurtosis),
+  `q<100*p>` for each of `PF:extstat_quantiles` and `exc<threshold>`
+  (fraction of members above the threshold) for each of
+  `PF:extstat_thresholds`. One collective per call:
+
+  - `nreal <= PF:extstat_exact`: the members are gathered on rank 0
+    of `comm`, all products are exact.
+  - otherwise: partials of a moment sketch (moments up to fourth
+    order, min, max, exceedance counts) are reduced. The quantiles
+    follow from the Cornish-Fisher expansion of the moments, clamped
+    to [min,max].
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_ensemblestatistics_ext(double* dat, int size, char* name, int cycle, int dim, MPI_Comm comm)
+{
+  int rank, i, k, t;
+  int nq = pf_extstat_nquantiles, nt = pf_extstat_nthresholds;
+  int nout = 4 + nq + nt;
+  int exact = nreal <= pf_extstat_exact;
+  size_t need;
+  char outname[100];
+
+  MPI_Comm_rank(comm,&rank);
+
+  if(rank == 0 && ext_out_capacity < (size_t) nout * size){
+    ext_out_capacity = (size_t) nout * size;
+    free(ext_out);
+    ext_out = (double*) malloc(ext_out_capacity * sizeof(double));
+  }
+
+  if(exact){
+    need = rank == 0 ? (size_t) nreal * size : 0;
+  }else{
+    need = (size_t) (ENKF_EXT_PARTIAL + nt) * size;
+  }
+  if(need > ext_capacity){
+    free(ext_buf);
+    ext_buf = (double*) malloc(need * sizeof(double));
+    ext_capacity = need;
+  }
+  if((need > 0 && ext_buf == NULL) || (rank == 0 && ext_out == NULL)){
+    printf("Error: could not allocate buffers for extended ensemble statistics (size %d)\n",size);
+    exit(1);
+  }
+
+  if(exact){
+    MPI_Gather(dat,size,MPI_DOUBLE,ext_buf,size,MPI_DOUBLE,0,comm);
+
+    if(rank == 0){
+      #pragma omp parallel
+      {
+        double *x = (double*) malloc(nreal * sizeof(double));
+        int m;
+        #pragma omp for
+        for(i=0;i<size;i++){
+          for(m=0;m<nreal;m++) x[m] = ext_buf[(size_t) m * size + i];
+          qsort(x,nreal,sizeof(double),enkf_compare_double);
+          enkf_ext_exact(x,nreal,&ext_out[i],size);
+        }
+        free(x);
+      }
+    }
+  }else{
+    int width = ENKF_EXT_PARTIAL + nt;
+
+    if(ext_op == MPI_OP_NULL || ext_width != width){
+      if(ext_op != MPI_OP_NULL){
+        MPI_Op_free(&ext_op);
+        MPI_Type_free(&ext_type);
+      }
+      ext_width = width;
+      MPI_Type_contiguous(width,MPI_DOUBLE,&ext_type);
+      MPI_Type_commit(&ext_type);
+      MPI_Op_create(enkf_ext_merge,1,&ext_op);
+    }
+
+    for(i=0;i<size;i++){
+      double *b = &ext_buf[(size_t) i * width];
+      b[0] = 1.0;
+      b[1] = dat[i];
+      b[2] = b[3] = b[4] = 0.0;
+      b[5] = b[6] = dat[i];
+      for(t=0;t<nt;t++) b[ENKF_EXT_PARTIAL+t] = dat[i] > pf_extstat_thresholds[t] ? 1.0 : 0.0;
+    }
+
+    if(rank == 0){
+      MPI_Reduce(MPI_IN_PLACE,ext_buf,size,ext_type,ext_op,0,comm);
+    }else{
+      MPI_Reduce(ext_buf,NULL,size,ext_type,ext_op,0,comm);
+    }
+
+    if(rank == 0){
+      double z[ENKF_EXTSTAT_MAX];
+      for(k=0;k<nq;k++) z[k] = enkf_normal_quantile(pf_extstat_quantiles[k]);
+
+      #pragma omp parallel for private(k, t)
+      for(i=0;i<size;i++){
+        double *b = &ext_buf[(size_t) i * width];
+        double n = b[0];
+        double m2 = b[2] / n;
+        double skew = m2 > 0.0 ? (b[3] / n) / (m2 * sqrt(m2)) : 0.0;
+        double kurt = m2 > 0.0 ? (b[4] / n) / (m2 * m2) - 3.0 : 0.0;
+        double sd = n > 1.0 ? sqrt(b[2] / (n - 1.0)) : 0.0;
+
+        ext_out[i]        = b[5];
+        ext_out[size+i]   = b[6];
+        ext_out[2*size+i] = skew;
+        ext_out[3*size+i] = kurt;
+        for(k=0;k<nq;k++){
+          double w = z[k] + (z[k]*z[k] - 1.0) * skew / 6.0
+                   + (z[k]*z[k]*z[k] - 3.0*z[k]) * kurt / 24.0
+                   - (2.0*z[k]*z[k]*z[k] - 5.0*z[k]) * skew * skew / 36.0;
+          double v = b[1] + sd * w;
+          if(v < b[5]) v = b[5];
+          if(v > b[6]) v = b[6];
+          ext_out[(4+k)*(size_t)size+i] = v;
+        }
+        for(t=0;t<nt;t++) ext_out[(4+nq+t)*(size_t)size+i] = b[ENKF_EXT_PARTIAL+t] / n;
+      }
+    }
+  }
+
+  if(task_id==1){
+    sprintf(outname,"%s.min",name);
+    enkf_printstatistics_pfb(ext_out,outname,cycle,pfoutfile_stat,dim);
+    sprintf(outname,"%s.max",name);
+    enkf_printstatistics_pfb(&ext_out[size],outname,cycle,pfoutfile_stat,dim);
+    sprintf(outname,"%s.skew",name);
+    enkf_printstatistics_pfb(&ext_out[2*(size_t)size],outname,cycle,pfoutfile_stat,dim);
+    sprintf(outname,"%s.kurt",name);
+    enkf_printstatistics_pfb(&ext_out[3*(size_t)size],outname,cycle,pfoutfile_stat,dim);
+    for(k=0;k<nq;k++){
+      sprintf(outname,"%s.q%g",name,100.0*pf_extstat_quantiles[k]);
+      enkf_printstatistics_pfb(&ext_out[(4+k)*(size_t)size],outname,cycle,pfoutfile_stat,dim);
+    }
+    for(t=0;t<nt;t++){
+      sprintf(outname,"%s.exc%g",name,pf_extstat_thresholds[t]);
+      enkf_printstatistics_pfb(&ext_out[(4+nq+t)*(size_t)size],outname,cycle,pfoutfile_stat,dim);
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Free the buffer and MPI objects of the statistics reduction.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_ensemblestatistics_free()
+{
+  free(stat_pack);
+  stat_pack = NULL;
+  stat_capacity = 0;
+  if(stat_op != MPI_OP_NULL){
+    MPI_Op_free(&stat_op);
+    MPI_Type_free(&stat_type);
+  }
+  free(ext_buf);
+  free(ext_out);
+  ext_buf = ext_out = NULL;
+  ext_capacity = ext_out_capacity = 0;
+  if(ext_op != MPI_OP_NULL){
+    MPI_Op_free(&ext_op);
+    MPI_Type_free(&ext_type);
+  }
 }
 
 /*-------------------------------------------------------------------------*/
@@ -133,3 +745,28 @@ void enkf_printstatistics_pfb (double *dat, char* name, int cycle, char* prefix,
   /* 2. Invoke function */
   enkf_printvec(outfile,outfile_ts,dat,dim);
 }
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Print a field of the ensemble member
+  @param[in]   double* dat Vector of data to be printed.
+  @param[in]   char* name Name of the output file.
+  @param[in]   int cycle Number used as suffix.
+  @param[in]   int dim Number of dimensions of data vector.
+
+  `PF:ensemble_output = 0`: one PFB file per member (prefix
+  `pfoutfile_ens`), see `enkf_printstatistics_pfb`.
+
+  `PF:ensemble_output > 0`: one file for all members (prefix
+  `pfoutfile_stat`), see `enkf_output_ensemble`. Collective over all
+  ParFlow PEs of the ensemble.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_printensemble_pfb (double *dat, char* name, int cycle, int dim)
+{
+  if(pf_ensemble_output > 0){
+    enkf_printvec_ensemble(name,cycle,dat,dim);
+  }else{
+    enkf_printstatistics_pfb(dat,name,cycle,pfoutfile_ens,dim);
+  }
+}
@@ -0,0 +1,686 @@
+/*-----------------------------------------------------------------------------------------
+Copyright (c) 2013-2016 by Wolfgang Kurtz, Guowei He and Mukund Pondkule (Forschungszentrum Juelich GmbH)
+
+This file is part of TSMP-PDAF
+
+TSMP-PDAF is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TSMP-PDAF is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU LesserGeneral Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with TSMP-PDAF.  If not, see <http://www.gnu.org/licenses/>.
+-------------------------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------------------------------
+enkf_output.c: PFB output for ParFlow
+
+Asynchronous output (`PF:output_queue`): the output routines convert
+the PE-local data to the file format in a queue slot and return. A
+background thread writes the slots with `pwrite`, so that the file
+system access overlaps the next forecast. The number of slots is
+`PF:output_queue`; when all are in use, the caller waits for the
+oldest write to finish.
+
+All MPI communication (file offsets of the subgrids) is done by the
+calling thread, the writer thread only does POSIX I/O.
+
+Encoded output (`PF:output_precision`, `PF:output_compression`):
+files `*.epfb` with the layout of PFB, but the data of each subgrid
+is stored as float32, scaled int16 or byte-shuffled and deflated
+(see `enkf_output_encode`). Each subgrid header is followed by a
+32-byte encoding header (precision, compression, size of data, offset,
+scale). Compression needs zlib: build with `TSMPPDAFZLIB=1`. The
+format and a reader for `*.pfb` and `*.epfb` are in `read_epfb.py`.
+
+`enkf_output_ensemble` writes a field of all ensemble members to a
+single file with collective MPI-IO (`PF:ensemble_output`).
+-------------------------------------------------------------------------------------------*/
+#include "enkf.h"
+#include "enkf_parflow.h"
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/* PFB: global header and header of each subgrid, in bytes */
+#define ENKF_PFB_HEADER    64
+#define ENKF_PFB_SUBHEADER 36
+
+/* encoded files: header of the data of each subgrid, in bytes
+   (precision, compression, size of data, offset, scale) */
+#define ENKF_ENC_HEADER    32
+
+/* fields of the appended ensemble output (`PF:ensemble_output = 2`) */
+#define ENKF_MAX_RECORDS   32
+
+typedef struct {
+	char          filename[600];
+	unsigned char *buf;        /* subgrids of this PE, file format */
+	long long     capacity;
+	long long     size;
+	long long     offset;      /* file offset of `buf` */
+	long long     filesize;
+	int           root;        /* 1: write global header and set file size */
+	unsigned char header[ENKF_PFB_HEADER];
+} enkf_output_job;
+
+static enkf_output_job *jobs = NULL;
+static int             njobs = 0;
+static int             jobs_head = 0;
+static int             jobs_count = 0;
+static int             writer_stop = 0;
+static pthread_t       writer;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  jobs_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  jobs_done = PTHREAD_COND_INITIALIZER;
+
+/* synchronous output (`PF:output_queue = 0`) */
+static enkf_output_job sync_job;
+
+/* work arrays of the calling thread */
+static double        *gather_buf = NULL;
+static unsigned char *enc_raw = NULL;
+static unsigned char *enc_shuffled = NULL;
+static long long     gather_capacity = 0;
+static long long     enc_raw_capacity = 0;
+static long long     enc_shuffled_capacity = 0;
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Convert values to big-endian byte order (in place).
+  @param    buf    Values.
+  @param    n      Number of values.
+  @param    size   Size of a value in bytes.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_output_bigendian(void *buf, long long n, int size) {
+	const int one = 1;
+	unsigned char *p = (unsigned char *) buf;
+	long long i;
+	int b;
+
+	if(*(const unsigned char *) &one == 0) return;
+
+	for(i=0;i<n;i++,p+=size){
+		for(b=0;b<size/2;b++){
+			unsigned char t = p[b];
+			p[b] = p[size-1-b];
+			p[size-1-b] = t;
+		}
+	}
+}
+
+static void *enkf_output_reserve(void *buf, long long *capacity, long long size) {
+	if(size <= *capacity) return buf;
+	buf = realloc(buf, size);
+	if(buf == NULL){
+		printf("Error: enkf_output: cannot allocate %lld bytes\n", size);
+		exit(1);
+	}
+	*capacity = size;
+	return buf;
+}
+
+/* 1 if output is written as encoded files (`PF:output_precision`,
+   `PF:output_compression`) */
+static int enkf_output_encoded() {
+	return pf_output_precision != 64 || pf_output_compression != 0;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Encode the data of a subgrid.
+  @param    out    Output: encoding header and encoded data.
+  @param    v      Data of the subgrid.
+  @param    n      Number of values.
+  @return   Number of bytes written to `out`.
+
+  `PF:output_precision`: 64 (double), 32 (float) or 16 (integer
+  scaled to the range of the subgrid, `v = offset + scale *
+  (q + 32767)`). `PF:output_compression = 1` shuffles the bytes of
+  the values (all first bytes, then all second bytes, ...) and
+  compresses the result with deflate. All numbers are big-endian.
+ */
+/*--------------------------------------------------------------------------*/
+static long long enkf_output_encode(unsigned char *out, double *v, long long n) {
+	int size = pf_output_precision / 8;
+	long long nbytes = n * size;
+	long long lhead;
+	long long i;
+	int ihead[2] = {pf_output_precision, pf_output_compression};
+	double dhead[2] = {0.0, 1.0};
+	unsigned char *raw = pf_output_compression ? enc_raw : out + ENKF_ENC_HEADER;
+
+	if(pf_output_precision == 64){
+		memcpy(raw, v, nbytes);
+	}
+	else if(pf_output_precision == 32){
+		float *f = (float *) raw;
+		for(i=0;i<n;i++) f[i] = (float) v[i];
+	}
+	else{
+		short *q = (short *) raw;
+		double vmin = HUGE_VAL, vmax = -HUGE_VAL;
+		for(i=0;i<n;i++){
+			if(v[i] < vmin) vmin = v[i];
+			if(v[i] > vmax) vmax = v[i];
+		}
+		if(n == 0) vmin = vmax = 0.0;
+		dhead[0] = vmin;
+		dhead[1] = vmax > vmin ? (vmax - vmin) / 65534.0 : 1.0;
+		for(i=0;i<n;i++) q[i] = (short) (lround((v[i] - vmin) / dhead[1]) - 32767);
+	}
+	enkf_output_bigendian(raw, n, size);
+
+	if(pf_output_compression){
+#ifdef USE_ZLIB
+		uLongf len = compressBound(nbytes);
+		int b;
+		for(b=0;b<size;b++){
+			for(i=0;i<n;i++) enc_shuffled[b*n + i] = raw[i*size + b];
+		}
+		if(compress2(out + ENKF_ENC_HEADER, &len, enc_shuffled, nbytes, 1) != Z_OK){
+			printf("Error: enkf_output: compression failed\n");
+			exit(1);
+		}
+		nbytes = len;
+#endif
+	}
+
+	lhead = nbytes;
+	enkf_output_bigendian(ihead, 2, sizeof(int));
+	enkf_output_bigendian(&lhead, 1, sizeof(long long));
+	enkf_output_bigendian(dhead, 2, sizeof(double));
+	memcpy(out, ihead, 8);
+	memcpy(out + 8, &lhead, 8);
+	memcpy(out + 16, dhead, 16);
+
+	return ENKF_ENC_HEADER + nbytes;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Convert the data of this PE to the file format.
+  @param    buf         Output buffer, resized if needed.
+  @param    capacity    Size of `buf` in bytes.
+  @param    subgrids    Subgrid table of `data`.
+  @param    nsubgrids   Number of subgrids.
+  @param    data        PE-local data in the layout of the state arrays.
+  @return   Number of bytes in `buf`.
+
+  Each subgrid is stored as PFB subgrid header followed by the data,
+  either big-endian doubles (PFB) or encoded (`enkf_output_encode`).
+ */
+/*--------------------------------------------------------------------------*/
+static long long enkf_output_pack(unsigned char **buf, long long *capacity, enkf_subgrid *subgrids, int nsubgrids, double *data) {
+	unsigned char *p;
+	long long bound = 0;
+	int sg;
+
+	for(sg=0;sg<nsubgrids;sg++){
+		long long n = (long long) subgrids[sg].nx * subgrids[sg].ny * subgrids[sg].nz;
+		bound += ENKF_PFB_SUBHEADER + ENKF_ENC_HEADER + n * sizeof(double);
+#ifdef USE_ZLIB
+		if(pf_output_compression) bound += compressBound(n * sizeof(double)) - n * sizeof(double);
+#endif
+		if(pf_output_compression){
+			enc_raw = enkf_output_reserve(enc_raw, &enc_raw_capacity, n * sizeof(double));
+			enc_shuffled = enkf_output_reserve(enc_shuffled, &enc_shuffled_capacity, n * sizeof(double));
+		}
+	}
+	*buf = enkf_output_reserve(*buf, capacity, bound);
+
+	p = *buf;
+	for(sg=0;sg<nsubgrids;sg++){
+		enkf_subgrid *s = &subgrids[sg];
+		long long n = (long long) s->nx * s->ny * s->nz;
+		int subheader[9] = {s->ix, s->iy, s->iz, s->nx, s->ny, s->nz, 0, 0, 0};
+
+		enkf_output_bigendian(subheader, 9, sizeof(int));
+		memcpy(p, subheader, ENKF_PFB_SUBHEADER);
+		p += ENKF_PFB_SUBHEADER;
+
+		if(enkf_output_encoded()){
+			p += enkf_output_encode(p, data + s->offset, n);
+		}else{
+			memcpy(p, data + s->offset, n * sizeof(double));
+			enkf_output_bigendian(p, n, sizeof(double));
+			p += n * sizeof(double);
+		}
+	}
+
+	return p - *buf;
+}
+
+static void enkf_output_pwrite(int fd, void *buf, size_t size, long long offset, char *filename) {
+	char *p = (char *) buf;
+	while(size > 0){
+		ssize_t n = pwrite(fd, p, size, (off_t) offset);
+		if(n <= 0){
+			printf("Error: enkf_output: writing %s failed\n", filename);
+			exit(1);
+		}
+		p += n;
+		size -= n;
+		offset += n;
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write the part of a PFB file belonging to this PE.
+  @param    job   Output job.
+
+  The root PE writes the global header and sets the final file size,
+  so that other PEs may write their subgrids in any order.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_output_write(enkf_output_job *job) {
+	int fd = open(job->filename, O_WRONLY | O_CREAT, 0644);
+
+	if(fd < 0){
+		printf("Error: enkf_output: cannot open %s\n", job->filename);
+		exit(1);
+	}
+
+	if(job->root){
+		if(ftruncate(fd, (off_t) job->filesize) != 0){
+			printf("Error: enkf_output: cannot resize %s\n", job->filename);
+			exit(1);
+		}
+		enkf_output_pwrite(fd, job->header, ENKF_PFB_HEADER, 0, job->filename);
+	}
+	enkf_output_pwrite(fd, job->buf, job->size, job->offset, job->filename);
+
+	close(fd);
+}
+
+static void *enkf_output_writer(void *arg) {
+	(void) arg;
+
+	pthread_mutex_lock(&jobs_lock);
+	for(;;){
+		while(jobs_count == 0 && !writer_stop) pthread_cond_wait(&jobs_queued, &jobs_lock);
+		if(jobs_count == 0) break;
+
+		/* the job keeps its slot until it is written */
+		pthread_mutex_unlock(&jobs_lock);
+		enkf_output_write(&jobs[jobs_head]);
+		pthread_mutex_lock(&jobs_lock);
+
+		jobs_head = (jobs_head + 1) % njobs;
+		jobs_count--;
+		pthread_cond_broadcast(&jobs_done);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+
+	return NULL;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Start the output thread.
+  @param    size   Maximum PE-local size of an output field.
+
+  No thread is started for `PF:output_queue = 0` (synchronous output).
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_init(int size) {
+	int i;
+
+#ifndef USE_ZLIB
+	if(pf_output_compression){
+		printf("Error: PF:output_compression=1 requires building with TSMPPDAFZLIB=1 (USE_ZLIB, -lz)\n");
+		exit(1);
+	}
+#endif
+
+	if(pf_output_queue <= 0) return;
+
+	njobs = pf_output_queue;
+	jobs = (enkf_output_job *) calloc(njobs, sizeof(enkf_output_job));
+	for(i=0;i<njobs;i++){
+		jobs[i].capacity = (long long) size * sizeof(double);
+		jobs[i].buf = (unsigned char *) malloc(jobs[i].capacity);
+	}
+
+	if(pthread_create(&writer, NULL, enkf_output_writer, NULL) != 0){
+		printf("Error: enkf_output_init: cannot start output thread\n");
+		exit(1);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    PFB file layout of a field.
+  @param    nsubgrids   Number of subgrids of this PE.
+  @param    size        Size of the subgrids of this PE in the file.
+  @param    dim         Number of dimensions of the field.
+  @param    offset      File offset of the first subgrid of this PE (output).
+  @param    filesize    Size of the file (output).
+  @param    header      Global PFB header, big-endian (output, root PE only).
+  @return   1 on the root PE of the ParFlow instance, which writes the
+            header at offset 0.
+
+  Collective over the PEs of the ParFlow instance.
+ */
+/*--------------------------------------------------------------------------*/
+static int enkf_output_layout(int nsubgrids, long long size, int dim, long long *offset, long long *filesize, unsigned char *header) {
+	long long local[2], global[2];
+	int rank;
+
+	local[0] = nsubgrids;
+	local[1] = size;
+	*offset = 0;
+	MPI_Comm_rank(amps_CommWorld, &rank);
+	MPI_Exscan(&local[1], offset, 1, MPI_LONG_LONG, MPI_SUM, amps_CommWorld);
+	MPI_Allreduce(local, global, 2, MPI_LONG_LONG, MPI_SUM, amps_CommWorld);
+	if(rank == 0) *offset = 0;
+	*offset += ENKF_PFB_HEADER;
+	*filesize = ENKF_PFB_HEADER + global[1];
+
+	if(rank == 0){
+		double x[3] = {BackgroundX(GlobalsBackground), BackgroundY(GlobalsBackground), BackgroundZ(GlobalsBackground)};
+		double dx[3] = {BackgroundDX(GlobalsBackground), BackgroundDY(GlobalsBackground), BackgroundDZ(GlobalsBackground)};
+		int n[3] = {nx_glob, ny_glob, dim == 2 ? 1 : nz_glob};
+		int ns = (int) global[0];
+
+		enkf_output_bigendian(x, 3, sizeof(double));
+		enkf_output_bigendian(n, 3, sizeof(int));
+		enkf_output_bigendian(dx, 3, sizeof(double));
+		enkf_output_bigendian(&ns, 1, sizeof(int));
+		memcpy(header, x, 24);
+		memcpy(header + 24, n, 12);
+		memcpy(header + 36, dx, 24);
+		memcpy(header + 60, &ns, 4);
+	}
+
+	return rank == 0;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write a state array to a PFB file.
+  @param    pre    Prefix of the file name.
+  @param    suff   Suffix of the file name.
+  @param    data   PE-local data in the layout of the state arrays.
+  @param    grid   ParFlow grid of `data`.
+  @param    dim    Number of dimensions of `data`.
+
+  The file is `<pre>.<suff>.pfb`, or `<pre>.<suff>.epfb` for encoded
+  output. With `PF:output_queue > 0`, the data is copied to the next
+  free queue slot and written by the output thread.
+
+  Collective over the PEs of the ParFlow instance.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_pfb(char *pre, char *suff, double *data, Grid *grid, int dim) {
+	enkf_output_job *job = &sync_job;
+	int nsubgrids;
+	enkf_subgrid *subgrids = enkf_subgrid_table(grid, &nsubgrids);
+
+	/* wait for a free slot */
+	if(njobs > 0){
+		pthread_mutex_lock(&jobs_lock);
+		while(jobs_count == njobs) pthread_cond_wait(&jobs_done, &jobs_lock);
+		job = &jobs[(jobs_head + jobs_count) % njobs];
+		pthread_mutex_unlock(&jobs_lock);
+	}
+
+	sprintf(job->filename, "%s.%s.%s", pre, suff, enkf_output_encoded() ? "epfb" : "pfb");
+	job->size = enkf_output_pack(&job->buf, &job->capacity, subgrids, nsubgrids, data);
+	job->root = enkf_output_layout(nsubgrids, job->size, dim, &job->offset, &job->filesize, job->header);
+
+	if(njobs > 0){
+		pthread_mutex_lock(&jobs_lock);
+		jobs_count++;
+		pthread_cond_signal(&jobs_queued);
+		pthread_mutex_unlock(&jobs_lock);
+	}else{
+		enkf_output_write(job);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write a ParFlow Vector to a PFB file.
+  @param    pre      Prefix of the file name.
+  @param    suff     Suffix of the file name.
+  @param    vector   ParFlow Vector.
+  @param    dim      Number of dimensions of `vector`.
+
+  See `enkf_output_pfb`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_vector(char *pre, char *suff, Vector *vector, int dim) {
+	enkf_field field;
+
+	gather_buf = enkf_output_reserve(gather_buf, &gather_capacity, (long long) enkf_getsubvectorsize(VectorGrid(vector)) * sizeof(double));
+	enkf_field_set(&field, vector, gather_buf, 1, ENKF_TRANSFORM_NONE);
+	enkf_gather(&field, 1);
+	enkf_output_pfb(pre, suff, gather_buf, VectorGrid(vector), dim);
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Continue an appended ensemble output file after a restart.
+  @param    name    Name of the field.
+  @param    cycle   First cycle written after the restart.
+  @param    writer  1 on the PE that writes the index file.
+  @param    count   Number of records kept.
+  @param    end     File offset behind the records kept.
+
+  `PF:restart` with `PF:ensemble_output = 2`: the records of the
+  cycles before `cycle` in `<pfoutfile_stat>.<name>.ens.idx` are kept,
+  the following records are overwritten. Read by the first member of
+  each `comm_couple` and broadcast. The writer replaces the index file
+  by the records kept; the new file is renamed into place, so that the
+  other PEs read either version and find the same records.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_output_seed_records(char *name, int cycle, int writer, int *count, long long *end) {
+	MPI_Comm  comm_couple_c = MPI_Comm_f2c(comm_couple);
+	char      filename[600], tmpname[610];
+	long long seed[2] = {0, 0};
+	long long offset, size;
+	int       member, record, rcycle;
+	FILE      *fidx, *ftmp = NULL;
+
+	MPI_Comm_rank(comm_couple_c, &member);
+	if(member == 0){
+		sprintf(filename, "%s.%s.ens.idx", pfoutfile_stat, name);
+		fidx = fopen(filename, "r");
+		if(fidx != NULL){
+			if(writer){
+				sprintf(tmpname, "%s.tmp", filename);
+				ftmp = fopen(tmpname, "w");
+				if(ftmp == NULL){
+					printf("Error: enkf_output_ensemble: cannot open %s\n", tmpname);
+					exit(1);
+				}
+			}
+			while(fscanf(fidx, "%d %d %lld %lld", &record, &rcycle, &offset, &size) == 4){
+				if(rcycle >= cycle) break;
+				seed[0]++;
+				seed[1] = offset + size;
+				if(ftmp != NULL) fprintf(ftmp, "%d %d %lld %lld\n", record, rcycle, offset, size);
+			}
+			fclose(fidx);
+			if(ftmp != NULL){
+				fclose(ftmp);
+				if(rename(tmpname, filename) != 0){
+					printf("Error: enkf_output_ensemble: cannot replace %s\n", filename);
+					exit(1);
+				}
+			}
+		}
+	}
+	MPI_Bcast(seed, 2, MPI_LONG_LONG, 0, comm_couple_c);
+	*count = (int) seed[0];
+	*end   = seed[1];
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write a field of all ensemble members to one file
+            (`PF:ensemble_output`).
+  @param    name    Name of the field.
+  @param    cycle   Assimilation cycle.
+  @param    data    PE-local data in the layout of the state arrays.
+  @param    grid    ParFlow grid of `data`.
+  @param    dim     Number of dimensions of `data`.
+
+  The file holds one PFB image per ensemble member (encoded image for
+  `PF:output_precision`/`PF:output_compression`), ordered by member
+  (rank in `comm_couple`). `PF:ensemble_output = 1` writes one file
+  per field and cycle, `<pfoutfile_stat>.<name>.ens.<cycle>.pfb`.
+  `PF:ensemble_output = 2` appends a record of all members to
+  `<pfoutfile_stat>.<name>.ens.pfb` at each call; record number, cycle,
+  file offset and size of each record are listed in
+  `<pfoutfile_stat>.<name>.ens.idx`. After `PF:restart` the file is
+  continued behind the cycles before the checkpoint.
+
+  The PEs holding the same subgrids in all members (`comm_couple`)
+  write their part of the file with one collective MPI-IO call.
+  Collective over all ParFlow PEs of the ensemble.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_ensemble(char *name, int cycle, double *data, Grid *grid, int dim) {
+	static char      records_name[ENKF_MAX_RECORDS][100];
+	static int       records_count[ENKF_MAX_RECORDS];
+	static long long records_end[ENKF_MAX_RECORDS];
+	static int       nrecords = 0;
+	static unsigned char *buf = NULL;
+	static long long capacity = 0;
+	MPI_Comm    comm_couple_c = MPI_Comm_f2c(comm_couple);
+	MPI_File    fh;
+	MPI_Offset  offset;
+	unsigned char header[ENKF_PFB_HEADER];
+	long long   size, chunk, imagesize, imageoffset = 0, recordsize, recordoffset = 0;
+	char        filename[600];
+	const char  *ext = enkf_output_encoded() ? "epfb" : "pfb";
+	int         nsubgrids, root, member, r = 0;
+	int         record = 0;
+	enkf_subgrid *subgrids = enkf_subgrid_table(grid, &nsubgrids);
+
+	/* image of this member: header (root) and subgrids */
+	size = enkf_output_pack(&buf, &capacity, subgrids, nsubgrids, data);
+	root = enkf_output_layout(nsubgrids, size, dim, &chunk, &imagesize, header);
+
+	/* offset of the image in the record */
+	MPI_Comm_rank(comm_couple_c, &member);
+	MPI_Exscan(&imagesize, &imageoffset, 1, MPI_LONG_LONG, MPI_SUM, comm_couple_c);
+	MPI_Allreduce(&imagesize, &recordsize, 1, MPI_LONG_LONG, MPI_SUM, comm_couple_c);
+	if(member == 0) imageoffset = 0;
+
+	if(pf_ensemble_output == 2){
+		for(r=0;r<nrecords;r++){
+			if(strcmp(records_name[r], name) == 0) break;
+		}
+		if(r == nrecords){
+			if(nrecords == ENKF_MAX_RECORDS){
+				printf("Error: enkf_output_ensemble: more than %d output fields\n", ENKF_MAX_RECORDS);
+				exit(1);
+			}
+			strcpy(records_name[r], name);
+			records_count[r] = 0;
+			records_end[r] = 0;
+			if(pf_restart) enkf_output_seed_records(name, cycle, root && member == 0, &records_count[r], &records_end[r]);
+			nrecords++;
+		}
+		record = records_count[r]++;
+		recordoffset = records_end[r];
+		records_end[r] += recordsize;
+		sprintf(filename, "%s.%s.ens.%s", pfoutfile_stat, name, ext);
+	}else{
+		sprintf(filename, "%s.%s.ens.%05d.%s", pfoutfile_stat, name, cycle, ext);
+	}
+
+	if(root){
+		/* header in front of the subgrids of this PE */
+		buf = enkf_output_reserve(buf, &capacity, size + ENKF_PFB_HEADER);
+		memmove(buf + ENKF_PFB_HEADER, buf, size);
+		memcpy(buf, header, ENKF_PFB_HEADER);
+		size += ENKF_PFB_HEADER;
+		chunk = 0;
+	}
+	offset = recordoffset + imageoffset + chunk;
+
+	if(MPI_File_open(comm_couple_c, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS){
+		printf("Error: enkf_output_ensemble: cannot open %s\n", filename);
+		exit(1);
+	}
+	if(pf_ensemble_output == 1){
+		/* remove data of an older, larger file */
+		MPI_File_set_size(fh, (MPI_Offset) recordsize);
+	}
+	if(MPI_File_write_at_all(fh, offset, buf, (int) size, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS){
+		printf("Error: enkf_output_ensemble: writing %s failed\n", filename);
+		exit(1);
+	}
+	MPI_File_close(&fh);
+
+	/* index of the records */
+	if(pf_ensemble_output == 2 && root && member == 0){
+		FILE *fidx;
+		sprintf(filename, "%s.%s.ens.idx", pfoutfile_stat, name);
+		fidx = fopen(filename, record == 0 ? "w" : "a");
+		if(fidx == NULL){
+			printf("Error: enkf_output_ensemble: cannot open %s\n", filename);
+			exit(1);
+		}
+		fprintf(fidx, "%d %d %lld %lld\n", record, cycle, recordoffset, recordsize);
+		fclose(fidx);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Wait until all queued output is written.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_flush() {
+	if(njobs == 0) return;
+
+	pthread_mutex_lock(&jobs_lock);
+	while(jobs_count > 0) pthread_cond_wait(&jobs_done, &jobs_lock);
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write all queued output and stop the output thread.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_output_finalize() {
+	int i;
+
+	free(sync_job.buf);
+	free(gather_buf);
+	free(enc_raw);
+	free(enc_shuffled);
+
+	if(njobs == 0) return;
+
+	pthread_mutex_lock(&jobs_lock);
+	writer_stop = 1;
+	pthread_cond_signal(&jobs_queued);
+	pthread_mutex_unlock(&jobs_lock);
+	pthread_join(writer, NULL);
+
+	for(i=0;i<njobs;i++) free(jobs[i].buf);
+	free(jobs);
+	jobs = NULL;
+	njobs = 0;
+}
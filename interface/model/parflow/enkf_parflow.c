@@ -37,6 +37,35 @@ amps_ThreadLocalDcl(Vector *, evap_trans);
 amps_ThreadLocalDcl(Vector *, vdummy_3d);
 amps_ThreadLocalDcl(Vector *, vdummy_2d);
 amps_ThreadLocalDcl(PFModule *, problem);
+/* forecast vectors of last AdvanceRichards (zero-copy state vector) */
+amps_ThreadLocalDcl(Vector *, zc_pressure);
+amps_ThreadLocalDcl(Vector *, zc_saturation);
+amps_ThreadLocalDcl(Vector *, zc_porosity);
+static int zc_collected = 0;
+
+/* transformed parameters of the last gather, valid until the next
+   parameter write-back in `update_parflow` */
+static double *param_cache = NULL;
+static int param_dirty = 1;
+static int aniso_initialized = 0;
+
+/* parameters are written back before the state (porosity is used in
+   the conversion of soil water content) */
+static int param_writeback_first = 0;
+
+/* overland flow masking of parameters (1: keep forecast) and
+   ensemble statistics buffers of `enkf_parflow_update_param` */
+static double *param_keep = NULL;
+static double *param_stat = NULL;
+
+/* state indices of the river cells on this rank (overland flow
+   masking 2), built on first use */
+static int *river_cells = NULL;
+static int nriver_cells = 0;
+
+/* PF:gwmasking=2: ensemble sums of saturation and, for the ensemble
+   statistics, of pressure and swc (and their squares) */
+static double *gw_stat = NULL;
 
 //ProblemData *GetProblemDataRichards(PFModule *this_module);
 //Problem *GetProblemRichards(PFModule *this_module);
@@ -94,24 +123,26 @@ void init_idx_map_subvec2state(Vector *pf_vector) {
 	//}
 	//PF2ENKF(dz_mult, zcoord);
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
-
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+	nx_glob = BackgroundNX(GlobalsBackground);
+	ny_glob = BackgroundNY(GlobalsBackground);
+	nz_glob = BackgroundNZ(GlobalsBackground);
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+	/* subgrid table of the state grid, subgrid `sg` starts at
+	   `enkf_subgrids[sg].offset` in the state arrays */
+	enkf_subgrids = enkf_subgrid_table(grid, &enkf_nsubgrids);
 
-		nx_glob = BackgroundNX(GlobalsBackground);
-		ny_glob = BackgroundNY(GlobalsBackground);
-	       	nz_glob = BackgroundNZ(GlobalsBackground);
+#pragma omp parallel for schedule(dynamic)
+	for (sg = 0; sg < enkf_nsubgrids; sg++)
+	{
+		int ix = enkf_subgrids[sg].ix;
+		int iy = enkf_subgrids[sg].iy;
+		int iz = enkf_subgrids[sg].iz;
+		int nx = enkf_subgrids[sg].nx;
+		int ny = enkf_subgrids[sg].ny;
+		int nz = enkf_subgrids[sg].nz;
 
 		int i, j, k;
-		int counter = 0;
+		int counter = enkf_subgrids[sg].offset;
 
 		for (k = iz; k < iz + nz; k++) {
 			for (j = iy; j < iy + ny; j++) {
@@ -129,16 +160,18 @@ void init_idx_map_subvec2state(Vector *pf_vector) {
 				}
 			}
 		}
-
-      /* store local dimensions for later use */
-    nx_local = nx;
-    ny_local = ny;
-    nz_local = nz;
-    origin_local[0] = ix+1;
-    origin_local[1] = iy+1;
-    origin_local[2] = iz+1;
 	}
 
+	/* store local dimensions for later use (first subgrid, the
+	   column layout of the localized filters requires a single
+	   subgrid per rank) */
+	nx_local = enkf_subgrids[0].nx;
+	ny_local = enkf_subgrids[0].ny;
+	nz_local = enkf_subgrids[0].nz;
+	origin_local[0] = enkf_subgrids[0].ix+1;
+	origin_local[1] = enkf_subgrids[0].iy+1;
+	origin_local[2] = enkf_subgrids[0].iz+1;
+
 #ifdef PDAF_DEBUG
 	int idebug;
 	/* Debug output of idx_map_subvec2state, xcoord, ycoord, zcoord */
@@ -181,6 +214,31 @@ Vector **porosity_out, Vector **saturation_out);
   5. read in mask file (ascii) for overland flow masking
  */
 /*--------------------------------------------------------------------------*/
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Share a ParFlow Vector of the first ensemble member with all
+            members (`PF:shared_static_input`).
+  @param    pf_vector   ParFlow Vector, only set in the first member.
+
+  The PEs at the same position in all members hold the same subgrids,
+  the PE-local data is broadcast over `comm_couple`. Ghost cells are
+  not set.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_share_vector(Vector *pf_vector) {
+  MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
+  int size = enkf_getsubvectorsize(VectorGrid(pf_vector));
+  double *buf = (double*) malloc(size * sizeof(double));
+  enkf_field field;
+
+  enkf_field_set(&field, pf_vector, buf, 1, ENKF_TRANSFORM_NONE);
+  if(task_id == 1) enkf_gather(&field, 1);
+  MPI_Bcast(buf, size, MPI_DOUBLE, 0, comm_couple_c);
+  if(task_id != 1) enkf_scatter(&field, 1);
+
+  free(buf);
+}
+
 void enkfparflowinit(int ac, char *av[], char *input_file) {
 
   Grid *grid;
@@ -283,7 +341,13 @@ void enkfparflowinit(int ac, char *av[], char *input_file) {
     char *etfilename = GetEvapTransFilename(amps_ThreadLocal(solver));
     char  filename[256];
     sprintf(filename, "%s", etfilename);
-    ReadPFBinary( filename, evap_trans );
+    /* shared static input: read by first member only */
+    if(!pf_shared_static_input || task_id == 1){
+      ReadPFBinary( filename, evap_trans );
+    }
+    if(pf_shared_static_input){
+      enkf_share_vector(evap_trans);
+    }
     VectorUpdateCommHandle *handle;
     handle = InitVectorUpdate(evap_trans, VectorUpdateAll);
     FinalizeVectorUpdate(handle);
@@ -302,20 +366,42 @@ void enkfparflowinit(int ac, char *av[], char *input_file) {
   amps_ThreadLocal(vdummy_2d) = NewVectorType(VectorGrid(ProblemDataMannings(problem_data)),1,1,vector_cell_centered);
   InitVectorAll(amps_ThreadLocal(vdummy_2d),0.0);
 
+  /* start asynchronous output (`PF:output_queue`) */
+  int size_2d = enkf_getsubvectorsize(VectorGrid(vdummy_2d));
+  enkf_output_init(enkf_subvecsize > size_2d ? enkf_subvecsize : size_2d);
+
   /* read in mask file (ascii) for overland flow masking */
   if(pf_olfmasking == 2){
-    FILE *friverid=NULL;
+    char *buf = NULL, *p, *end;
+    long size = 0;
     int i;
-    friverid = fopen("river.dat","rb");
-    fscanf(friverid,"%d",&nriverid);
+    /* shared static input: read by one PE of the first member only,
+       file content broadcast within the first member, then to the
+       other members */
+    if(!pf_shared_static_input || (task_id == 1 && amps_Rank(amps_CommWorld) == 0)){
+      buf = enkf_read_file("river.dat",&size);
+    }
+    if(pf_shared_static_input){
+      if(task_id == 1) buf = enkf_bcast_bytes(buf,&size,0,amps_CommWorld);
+      buf = enkf_bcast_bytes(buf,&size,0,MPI_Comm_f2c(comm_couple));
+    }
+    if(buf == NULL){
+      printf("Error: cannot open river.dat\n");
+      exit(1);
+    }
+
+    nriverid = (int) strtol(buf,&p,10);
     riveridx = (int*) calloc(sizeof(int),nriverid);
     riveridy = (int*) calloc(sizeof(int),nriverid);
     for(i=0;i<nriverid;i++){
-      fscanf(friverid,"%d %d",&riveridx[i],&riveridy[i]);
-      riveridx[i] = riveridx[i]-1;
-      riveridy[i] = riveridy[i]-1;
+      riveridx[i] = (int) strtol(p,&end,10) - 1;
+      riveridy[i] = (int) strtol(end,&p,10) - 1;
+      if(p == end){
+        printf("Error: river.dat contains %d of %d cells\n",i,nriverid);
+        exit(1);
+      }
     }
-    fclose(friverid);
+    free(buf);
   }
 
 }
@@ -386,15 +472,9 @@ void parflow_oasis_init(double current_time, double dt) {
   idx_map_subvec2state   = (int *)   malloc(enkf_subvecsize * sizeof(int));
   init_idx_map_subvec2state(pressure_in);
 
-  /* Set statevector-size and allocate ParFlow Subvectors */
-  pf_statevecsize = enkf_subvecsize;
-  if(pf_updateflag == 3) pf_statevecsize = pf_statevecsize * 2;
-  pf_paramvecsize = enkf_subvecsize;
-  if(pf_paramupdate == 2) pf_paramvecsize = nx_local*ny_local;
-  if(pf_paramupdate == 4 || pf_paramupdate == 5) pf_paramvecsize = 2*enkf_subvecsize;
-  if(pf_paramupdate == 6 || pf_paramupdate == 7) pf_paramvecsize = 3*enkf_subvecsize;
-  if(pf_paramupdate == 8) pf_paramvecsize = 4*enkf_subvecsize;
-  if(pf_paramupdate > 0) pf_statevecsize += pf_paramvecsize;
+  /* Set state vector layout (`pf_blocks`, `pf_statevecsize`,
+     `pf_paramvecsize`) and allocate ParFlow Subvectors */
+  enkf_parflow_init_blocks();
 
 #ifdef PDAF_DEBUG
   /* Debug output of parflow statevectorsize */
@@ -405,6 +485,9 @@ void parflow_oasis_init(double current_time, double dt) {
   subvec_sat             = (double*) calloc(enkf_subvecsize,sizeof(double));
   subvec_porosity        = (double*) calloc(enkf_subvecsize,sizeof(double));
   subvec_param           = (double*) calloc(pf_paramvecsize,sizeof(double));
+  param_cache            = (double*) calloc(pf_paramvecsize,sizeof(double));
+  param_keep             = (double*) calloc(pf_paramvecsize,sizeof(double));
+  param_stat             = (double*) calloc(pf_paramvecsize,sizeof(double));
   subvec_mean            = (double*) calloc(enkf_subvecsize,sizeof(double));
   subvec_sd              = (double*) calloc(enkf_subvecsize,sizeof(double));
   subvec_param_mean      = (double*) calloc(pf_paramvecsize,sizeof(double));
@@ -420,32 +503,101 @@ void parflow_oasis_init(double current_time, double dt) {
   if(pf_gwmasking > 0){
     subvec_gwind           = (double*) calloc(enkf_subvecsize,sizeof(double));
   }
-  if(pf_paramupdate == 4){
-    dat_alpha          = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_n              = (double*) calloc(enkf_subvecsize,sizeof(double));
-  }
-  else if(pf_paramupdate == 5){
-    dat_ksat    = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_poro    = (double*) calloc(enkf_subvecsize,sizeof(double));
-  }
-  else if(pf_paramupdate == 6){
-    dat_ksat     = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_alpha    = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_n        = (double*) calloc(enkf_subvecsize,sizeof(double));
+  if(pf_gwmasking == 2){
+    gw_stat                = (double*) calloc((pf_printstat == 1 ? 9 : 1)*enkf_subvecsize,sizeof(double));
   }
-  else if(pf_paramupdate == 7){
-    dat_poro     = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_alpha    = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_n        = (double*) calloc(enkf_subvecsize,sizeof(double));
-  }
-  else if(pf_paramupdate == 8){
-    dat_ksat     = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_poro     = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_alpha    = (double*) calloc(enkf_subvecsize,sizeof(double));
-    dat_n        = (double*) calloc(enkf_subvecsize,sizeof(double));
+  /* zero-copy: PDAF's state vector is filled directly from ParFlow */
+  if(!pf_zerocopy){
+    pf_statevec            = (double*) calloc(pf_statevecsize,sizeof(double));
   }
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Fill `gw_stat` for the reduction of PF:gwmasking=2.
+  @return   Number of packed fields of size `enkf_subvecsize`: 1 for
+            the sum of saturation (`MPI_SUM`), 3 for Welford partials
+            (`enkf_welford_op`).
+
+  Saturation; with ensemble statistics Welford partials (count, mean,
+  M2) of saturation, pressure and swc, so that the spread is computed
+  as in `enkf_ensemblestatistics`. The mixed state vector is pressure
+  or swc in each cell with the same switch in all members, so its
+  statistics follow from these partials.
+ */
+/*--------------------------------------------------------------------------*/
+static int enkf_parflow_gwstat_pack() {
+	int i, n = enkf_subvecsize;
+
+	if(pf_printstat != 1){
+		memcpy(gw_stat, subvec_sat, n * sizeof(double));
+		return 1;
+	}
+
+	#pragma omp parallel for
+	for(i=0;i<n;i++){
+		double *sat = &gw_stat[3 * i];
+		double *p   = &gw_stat[3 * (n + i)];
+		double *swc = &gw_stat[3 * (2 * n + i)];
+		sat[0] = 1.0; sat[1] = subvec_sat[i];                      sat[2] = 0.0;
+		p[0]   = 1.0; p[1]   = subvec_p[i];                        p[2]   = 0.0;
+		swc[0] = 1.0; swc[1] = subvec_sat[i] * subvec_porosity[i]; swc[2] = 0.0;
+	}
+	return 3;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Start the reduction of `gw_stat` over `comm_couple`.
+  @param    nstat    Number of packed fields (`enkf_parflow_gwstat_pack`).
+  @param    request  Request of the non-blocking reduction.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_parflow_gwstat_start(int nstat, MPI_Request *request) {
+	MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
+	MPI_Datatype type;
+	MPI_Op op;
+
+	if(nstat == 1){
+		MPI_Iallreduce(MPI_IN_PLACE,gw_stat,enkf_subvecsize,MPI_DOUBLE,MPI_SUM,comm_couple_c,request);
+	}else{
+		enkf_welford_op(&type,&op);
+		MPI_Iallreduce(MPI_IN_PLACE,gw_stat,nstat*enkf_subvecsize,type,op,comm_couple_c,request);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Ensemble sum of saturation in cell `i` from `gw_stat`.
+  @param    nstat    Number of packed fields.
+  @param    i        Cell.
+ */
+/*--------------------------------------------------------------------------*/
+static double enkf_parflow_gwstat_satsum(int nstat, int i) {
+	if(nstat == 1) return gw_stat[i];
+	return gw_stat[3 * i] * gw_stat[3 * i + 1];
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Ensemble statistics of the mixed state vector from `gw_stat`.
 
-  pf_statevec            = (double*) calloc(pf_statevecsize,sizeof(double));
+  Mean and standard deviation in `subvec_mean`/`subvec_sd` on
+  `task_id==1`, used by the next `printstat_parflow`.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_parflow_gwstat_unpack() {
+	int i, n = enkf_subvecsize;
+
+	if(task_id == 1){
+		for(i=0;i<n;i++){
+			int k = subvec_gwind[i] > 0.5 ? 1 : 2;
+			double *w = &gw_stat[3 * (k * n + i)];
+			subvec_mean[i] = w[1];
+			subvec_sd[i] = sqrt(w[2] / (w[0] - 1.0));
+		}
+	}
+	stat_precomputed = 1;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -489,21 +641,25 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
 
 	AdvanceRichards(amps_ThreadLocal(solver), current_time, stop_time, NULL, amps_ThreadLocal(evap_trans), &pressure_out, &porosity_out, &saturation_out);
 
-	handle = InitVectorUpdate(pressure_out, VectorUpdateAll);
-	FinalizeVectorUpdate(handle);
-	handle = InitVectorUpdate(porosity_out, VectorUpdateAll);
-	FinalizeVectorUpdate(handle);
-	handle = InitVectorUpdate(saturation_out, VectorUpdateAll);
-	FinalizeVectorUpdate(handle);
+	/* No ghost cell update of pressure_out, porosity_out and
+	   saturation_out: the state vector is gathered from owned cells
+	   only and `update_parflow` updates the ghost cells of all
+	   Vectors it writes to. */
 	/* END: wrf_parflow related part */
 	/* ----------------------------- */
 
+	/* zero-copy: remember forecast vectors, the state vector is
+	   collected from them in `enkf_parflow_collect_state` */
+	zc_pressure   = pressure_out;
+	zc_saturation = saturation_out;
+	zc_porosity   = porosity_out;
+
 	/* create state vector: pressure */
-	if(pf_updateflag == 1) {
-  	  PF2ENKF(pressure_out, subvec_p);
-  	  for(i=0;i<enkf_subvecsize;i++){
-             pf_statevec[i] = subvec_p[i];
-          }
+	if(pf_updateflag == 1 && !pf_zerocopy) {
+	  enkf_field fields[1];
+	  enkf_field_set(&fields[0], pressure_out, pf_statevec, 1, ENKF_TRANSFORM_NONE);
+	  fields[0].raw = subvec_p;
+	  enkf_gather(fields, 1);
 
           /* masking option using saturated cells only */
           if(pf_gwmasking == 1){
@@ -515,18 +671,30 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
 
           /* masking option using mixed state vector */
           if(pf_gwmasking == 2){
-            int no_obs,haveobs,tmpidx;
-            MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
+            int no_obs,tmpidx;
 
 	    /* 1. Overwrite pressure with soil water content in
 	       unsaturated part of `pf_statevec` */
 	    /* 2. Set saturation switch `subvec_gwind` */
-            PF2ENKF(saturation_out, subvec_sat);
-  	    PF2ENKF(porosity_out, subvec_porosity);
-            MPI_Allreduce(subvec_sat,subvec_mean,enkf_subvecsize,MPI_DOUBLE,MPI_SUM,comm_couple_c);
+            enkf_field fields_sw[2];
+            enkf_field_set(&fields_sw[0], saturation_out, subvec_sat, 1, ENKF_TRANSFORM_NONE);
+            enkf_field_set(&fields_sw[1], porosity_out, subvec_porosity, 1, ENKF_TRANSFORM_NONE);
+            enkf_gather(fields_sw, 2);
+
+	    /* Ensemble sum of saturation, with `printstat_parflow` as
+	       Welford partials together with the ensemble statistics.
+	       The reduction runs while the observation indices are
+	       read. */
+            int nstat = enkf_parflow_gwstat_pack();
+            MPI_Request request;
+            enkf_parflow_gwstat_start(nstat,&request);
+
+            get_obsindex_currentobsfile(&no_obs);
+
+            MPI_Wait(&request,MPI_STATUS_IGNORE);
 	    for(i=0;i<enkf_subvecsize;i++){
               subvec_gwind[i] = 1.0; /* saturated cell */
-              if(subvec_mean[i]< (double)nreal){
+              if(enkf_parflow_gwstat_satsum(nstat,i) < (double)nreal){
                 subvec_gwind[i] = 0.0; /* unsaturated cell */
 		/* SWC = saturation * porosity */
                 pf_statevec[i] = subvec_sat[i] * subvec_porosity[i];
@@ -536,38 +704,27 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
 
 	    /* Re-insert pressure for certain state vector cells based
 	       on pressure observations */
-            get_obsindex_currentobsfile(&no_obs);
 
-	    /* Check existence of observations in subgrid */
+	    /* If observation is pressure observation, set the column
+	       below the observation to pressure in the state vector
+	       (all cells of the column on this rank, also in subgrids
+	       below the subgrid of the observation) */
             for(i=0;i<no_obs;i++){
-              haveobs=0;
-              if((xidx_obs[i]>=origin_local[0]) && (xidx_obs[i]<(origin_local[0]+nx_local))){
-                if((yidx_obs[i]>=origin_local[1]) && (yidx_obs[i]<(origin_local[1]+ny_local))){
-                  if((zidx_obs[i]>=origin_local[2]) && (zidx_obs[i]<(origin_local[2]+nz_local))){
-                    haveobs=1;
+              if(ind_obs[i]==1){
+                for(j=0;j<zidx_obs[i];j++){
+                  tmpidx = enkf_subgrid_index(xidx_obs[i]-1, yidx_obs[i]-1, j);
+                  if(tmpidx >= 0){
+                    subvec_gwind[tmpidx] = 1.0;
+                    pf_statevec[tmpidx] = subvec_p[tmpidx];
                   }
                 }
               }
-
-	      /* If observation exists in subgrid AND observation is
-		 pressure observation, set the column below the
-		 observation to pressure in the state vector */
-              if(haveobs && ind_obs[i]==1){
-                for(j=0;j<=(zidx_obs[i]-origin_local[2]);j++){
-		  /* TODO: This code will only set the column INSIDE
-		     the local domain / subgrid. In prinicpal, the
-		     subgrid could be divided in z-direction and a
-		     deeper subgrid could still contain soil water
-		     content values below the pressure measurement. */
-                  tmpidx = nx_local*ny_local*j + nx_local*(yidx_obs[i]-origin_local[1]) + (xidx_obs[i]-origin_local[0]);
-                  subvec_gwind[tmpidx] = 1.0;
-                  pf_statevec[tmpidx] = subvec_p[tmpidx];
-                }
-              }
             }
 
             if(task_id == 1 && pf_printgwmask == 1) enkf_printstatistics_pfb(subvec_gwind,"gwind_corrected",tstartcycle + stat_dumpoffset,outdir,3);
 
+            if(nstat > 1) enkf_parflow_gwstat_unpack();
+
             clean_obs_pf();
           }
         }
@@ -594,11 +751,15 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
           /* } */
 #endif
 
-	  PF2ENKF(saturation_out, subvec_sat);
-	  PF2ENKF(porosity_out, subvec_porosity);
-	  for(i=0;i<enkf_subvecsize;i++) {
-            pf_statevec[i] = subvec_sat[i] * subvec_porosity[i];
-          }
+	  if(!pf_zerocopy){
+	    /* SWC = saturation * porosity */
+	    enkf_field fields[2];
+	    enkf_field_set(&fields[0], saturation_out, pf_statevec, 1, ENKF_TRANSFORM_NONE);
+	    fields[0].product = porosity_out;
+	    fields[0].raw = subvec_sat;
+	    enkf_field_set(&fields[1], porosity_out, subvec_porosity, 1, ENKF_TRANSFORM_NONE);
+	    enkf_gather(fields, 2);
+	  }
 
 
 #ifdef PDAF_DEBUG
@@ -626,8 +787,8 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
 	     after this routine, so the added value fits better than
 	     the current value. */
 	  if(pf_t_printensemble == tstartcycle + 1 || pf_t_printensemble < 0 ) {
-	    if(pf_printensemble == 1) {
-	      enkf_printstatistics_pfb(&pf_statevec[0],"integrate",tstartcycle + 1 + stat_dumpoffset,pfoutfile_ens,3);
+	    if(pf_printensemble == 1 && !pf_zerocopy) {
+	      enkf_printensemble_pfb(&pf_statevec[0],"integrate",tstartcycle + 1 + stat_dumpoffset,3);
 	    }
 	  }
 #endif
@@ -657,248 +818,87 @@ void enkfparflowadvance(int tcycle, double current_time, double dt)
 	}
 
 	/* create state vector: joint swc + pressure */
-        if(pf_updateflag == 3){
-          PF2ENKF(pressure_out, subvec_p);
-          PF2ENKF(saturation_out, subvec_sat);
-          PF2ENKF(porosity_out, subvec_porosity);
-	  for(i=0;i<enkf_subvecsize;i++){
-            pf_statevec[i] = subvec_sat[i] * subvec_porosity[i];
-          }
-          for(i=enkf_subvecsize,j=0;i<(2*enkf_subvecsize);i++,j++){
-            pf_statevec[i] = subvec_p[j];
-          }
-        }
-
-	/* append hydraulic conductivity to state vector */
-        if(pf_paramupdate == 1){
-           ProblemData *problem_data = GetProblemDataRichards(solver);
-           Vector      *perm_xx = ProblemDataPermeabilityX(problem_data);
-           handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-           FinalizeVectorUpdate(handle);
-           PF2ENKF(perm_xx,subvec_param);
-
-	   if(pf_aniso_use_parflow == 1){
-
-	     /* Get permabilities in y and z direction from Parflow */
-	     Vector      *perm_yy = ProblemDataPermeabilityY(problem_data);
-	     Vector      *perm_zz = ProblemDataPermeabilityZ(problem_data);
-
-	     /* Turn ParFlow-Vectors into arrays of subvector-size */
-	     PF2ENKF(perm_yy,subvec_permy);
-	     PF2ENKF(perm_zz,subvec_permz);
-
-	     /* Array loop */
-	     /* Set arr_aniso_perm_yy / arr_aniso_perm_zz */
-	     /* TODO: Compute only for first update */
-	     for(i=0;i<pf_paramvecsize;i++){
-	       arr_aniso_perm_yy[i] = subvec_permy[i] / subvec_param[i];
-	       arr_aniso_perm_zz[i] = subvec_permz[i] / subvec_param[i];
-	     }
-	   }
-
-
-           for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i++,j++){
-             pf_statevec[i] = log10(subvec_param[j]);
-           }
-        }
-
-	/* append Mannings coefficient to state vector */
-        if(pf_paramupdate == 2){
-           ProblemData *problem_data = GetProblemDataRichards(solver);
-           Vector       *mannings    = ProblemDataMannings(problem_data);
-           handle = InitVectorUpdate(mannings, VectorUpdateAll);
-           FinalizeVectorUpdate(handle);
-           PF2ENKF(mannings,subvec_param);
-           for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i++,j++){
-              pf_statevec[i] = log10(subvec_param[j]);
-           }
-        }
-
-        /* append Porosity to state vector */
-        if(pf_paramupdate == 3){
-           ProblemData *problem_data = GetProblemDataRichards(solver);
-           Vector       *porosity    = ProblemDataPorosity(problem_data);
-           handle = InitVectorUpdate(porosity, VectorUpdateAll);
-           FinalizeVectorUpdate(handle);
-           PF2ENKF(porosity, subvec_param);
-           for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i++,j++){
-               pf_statevec[i] = subvec_param[j];
-           }
-        }
-
-        /* append van Genuchten parameters to state vector */
-        if(pf_paramupdate == 4){
-           PFModule *relPerm = GetPhaseRelPerm(solver);
-           Vector *alpha = PhaseRelPermGetAlpha(relPerm);
-           Vector *n = PhaseRelPermGetN(relPerm);
-           handle = InitVectorUpdate(alpha, VectorUpdateAll);
-           FinalizeVectorUpdate(handle);
-           handle = InitVectorUpdate(n, VectorUpdateAll);
-           FinalizeVectorUpdate(handle);
-           PF2ENKF_2P(alpha, n, subvec_param);
-           for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i++,j++){
-               if((j%2)==0){
-                   pf_statevec[i] = log(subvec_param[j]);
-              }else{
-                   pf_statevec[i] = subvec_param[j];
-              }
-           }
-          }
-
-        /* append hydraulic conductivity and porosity to state vector */
-        if(pf_paramupdate == 5){
-            ProblemData *problem_data = GetProblemDataRichards(solver);
-            Vector      *perm_xx = ProblemDataPermeabilityX(problem_data);
-            Vector      *porosity    = ProblemDataPorosity(problem_data);
-            handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(porosity, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            PF2ENKF_2P(perm_xx,porosity,subvec_param);
-            for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i++,j++){
-                    if((j%2)==0){
-                        pf_statevec[i] = log10(subvec_param[j]);
-                    }else{
-                        pf_statevec[i] = subvec_param[j];
-                    }
-            }
-
-	   if(pf_aniso_use_parflow == 1){
-
-	     /* Get permabilities in y and z direction from Parflow */
-	     Vector      *perm_yy = ProblemDataPermeabilityY(problem_data);
-	     Vector      *perm_zz = ProblemDataPermeabilityZ(problem_data);
-
-	     /* Turn ParFlow-Vectors into arrays of subvector-size */
-	     PF2ENKF(perm_yy,subvec_permy);
-	     PF2ENKF(perm_zz,subvec_permz);
-
-	     /* Array loop */
-	     /* Set arr_aniso_perm_yy / arr_aniso_perm_zz */
-	     /* TODO: Compute only for first update */
-	     for(i=0,j=0;i<enkf_subvecsize;i++,j=j+2){
-	       arr_aniso_perm_yy[i] = subvec_permy[i] / subvec_param[j];
-	       arr_aniso_perm_zz[i] = subvec_permz[i] / subvec_param[j];
-	     }
-	   }
-
-        }
-
-        /* append hydraulic conductivity and van Genuchten parameters to state vector */
-        if(pf_paramupdate == 6){
-            ProblemData *problem_data = GetProblemDataRichards(solver);
-            PFModule    *relPerm = GetPhaseRelPerm(solver);
-            Vector      *perm_xx = ProblemDataPermeabilityX(problem_data);
-            Vector      *alpha = PhaseRelPermGetAlpha(relPerm);
-            Vector      *n     = PhaseRelPermGetN(relPerm);
-            handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(alpha, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(n, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            PF2ENKF_3P(perm_xx,alpha,n,subvec_param);
-            for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i=i+3,j=j+3){
-                    pf_statevec[i] = log10(subvec_param[j]);
-                    pf_statevec[i+1] = log(subvec_param[j+1]);
-                    pf_statevec[i+2] = subvec_param[j+2];
-            }
-
-	   if(pf_aniso_use_parflow == 1){
-
-	     /* Get permabilities in y and z direction from Parflow */
-	     Vector      *perm_yy = ProblemDataPermeabilityY(problem_data);
-	     Vector      *perm_zz = ProblemDataPermeabilityZ(problem_data);
-
-	     /* Turn ParFlow-Vectors into arrays of subvector-size */
-	     PF2ENKF(perm_yy,subvec_permy);
-	     PF2ENKF(perm_zz,subvec_permz);
-
-	     /* Array loop */
-	     /* Set arr_aniso_perm_yy / arr_aniso_perm_zz */
-	     /* TODO: Compute only for first update */
-	     for(i=0,j=0;i<enkf_subvecsize;i++,j=j+3){
-	       arr_aniso_perm_yy[i] = subvec_permy[i] / subvec_param[j];
-	       arr_aniso_perm_zz[i] = subvec_permz[i] / subvec_param[j];
-	     }
-	   }
-
-        }
-
-        /* append porosity and van Genuchten parameters to state vector */
-        if(pf_paramupdate == 7){
-            ProblemData *problem_data = GetProblemDataRichards(solver);
-            PFModule    *relPerm = GetPhaseRelPerm(solver);
-            Vector      *porosity    = ProblemDataPorosity(problem_data);
-            Vector      *alpha = PhaseRelPermGetAlpha(relPerm);
-            Vector      *n     = PhaseRelPermGetN(relPerm);
-            handle = InitVectorUpdate(porosity, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(alpha, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(n, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            PF2ENKF_3P(porosity,alpha,n,subvec_param);
-            for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i=i+3,j=j+3){
-                    pf_statevec[i] = subvec_param[j];
-                    pf_statevec[i+1] = log(subvec_param[j+1]);
-                    pf_statevec[i+2] = subvec_param[j+2];
-            }
+        if(pf_updateflag == 3 && !pf_zerocopy){
+          enkf_field fields[3];
+          enkf_field_set(&fields[0], saturation_out, pf_statevec, 1, ENKF_TRANSFORM_NONE);
+          fields[0].product = porosity_out;
+          fields[0].raw = subvec_sat;
+          enkf_field_set(&fields[1], porosity_out, subvec_porosity, 1, ENKF_TRANSFORM_NONE);
+          enkf_field_set(&fields[2], pressure_out, &pf_statevec[enkf_subvecsize], 1, ENKF_TRANSFORM_NONE);
+          fields[2].raw = subvec_p;
+          enkf_gather(fields, 3);
         }
 
-        /* append hydraulic conductivity, porosity and van Genuchten parameters to state vector */
-        if(pf_paramupdate == 8){
-            ProblemData *problem_data = GetProblemDataRichards(solver);
-            PFModule    *relPerm = GetPhaseRelPerm(solver);
-            Vector      *perm_xx = ProblemDataPermeabilityX(problem_data);
-            Vector      *porosity    = ProblemDataPorosity(problem_data);
-            Vector      *alpha = PhaseRelPermGetAlpha(relPerm);
-            Vector      *n     = PhaseRelPermGetN(relPerm);
-            handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(porosity, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(alpha, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            handle = InitVectorUpdate(n, VectorUpdateAll);
-            FinalizeVectorUpdate(handle);
-            PF2ENKF_4P(perm_xx,porosity,alpha,n,subvec_param);
-            for(i=(pf_statevecsize-pf_paramvecsize),j=0;i<pf_statevecsize;i=i+4,j=j+4){
-                    pf_statevec[i] = log10(subvec_param[j]);
-                    pf_statevec[i+1] = subvec_param[j+1];
-                    pf_statevec[i+2] = log(subvec_param[j+2]);
-                    pf_statevec[i+3] = subvec_param[j+3];
-            }
-
-	   if(pf_aniso_use_parflow == 1){
-
-	     /* Get permabilities in y and z direction from Parflow */
-	     Vector      *perm_yy = ProblemDataPermeabilityY(problem_data);
-	     Vector      *perm_zz = ProblemDataPermeabilityZ(problem_data);
-
-	     /* Turn ParFlow-Vectors into arrays of subvector-size */
-	     PF2ENKF(perm_yy,subvec_permy);
-	     PF2ENKF(perm_zz,subvec_permz);
+	/* index lists of the saturated / unsaturated cells for the
+	   masked write-back in `update_parflow` */
+	if(pf_gwmasking > 0){
+	  enkf_mask_build(&gw_saturated, subvec_gwind, 1.0);
+	  enkf_mask_build(&gw_unsaturated, subvec_gwind, 0.0);
+	}
 
-	     /* Array loop */
-	     /* Set arr_aniso_perm_yy / arr_aniso_perm_zz */
-	     /* TODO: Compute only for first update */
-	     for(i=0,j=0;i<enkf_subvecsize;i++,j=j+4){
-	       arr_aniso_perm_yy[i] = subvec_permy[i] / subvec_param[j];
-	       arr_aniso_perm_zz[i] = subvec_permz[i] / subvec_param[j];
+	/* append parameters to state vector: transformed values to
+	   `pf_statevec`, untransformed values to `subvec_param`.
+	   The parameters only change in `update_parflow`, so they are
+	   gathered again only after a write-back (`param_dirty`),
+	   otherwise the transformed values are copied from
+	   `param_cache`. */
+        if(pf_paramupdate > 0){
+           double *pf_paramvec = &pf_statevec[pf_statevecsize-pf_paramvecsize];
+
+           if(param_dirty){
+             enkf_field fields[ENKF_MAX_BLOCKS];
+             int nfields = enkf_parflow_paramfields(fields, pf_paramvec);
+
+             /* owned cells only, no ghost cell update needed */
+             enkf_gather(fields, nfields);
+             memcpy(param_cache, pf_paramvec, pf_paramvecsize * sizeof(double));
+             param_dirty = 0;
+
+	     /* anisotropy of hydraulic conductivity from ParFlow,
+		`subvec_param` starts with the perm_xx block, if updated. The
+		ratios are kept by the write-back of perm_yy/perm_zz, so
+		they are computed only once. */
+	     if(pf_aniso_use_parflow == 1 && !aniso_initialized && (pf_paramupdate == 1 || pf_paramupdate == 5 || pf_paramupdate == 6 || pf_paramupdate == 8)){
+	       ProblemData *problem_data = GetProblemDataRichards(solver);
+
+	       /* Get permabilities in y and z direction from Parflow */
+	       Vector      *perm_yy = ProblemDataPermeabilityY(problem_data);
+	       Vector      *perm_zz = ProblemDataPermeabilityZ(problem_data);
+
+	       /* Turn ParFlow-Vectors into arrays of subvector-size */
+	       enkf_field fields_aniso[2];
+	       enkf_field_set(&fields_aniso[0], perm_yy, subvec_permy, 1, ENKF_TRANSFORM_NONE);
+	       enkf_field_set(&fields_aniso[1], perm_zz, subvec_permz, 1, ENKF_TRANSFORM_NONE);
+	       enkf_gather(fields_aniso, 2);
+
+	       /* Set arr_aniso_perm_yy / arr_aniso_perm_zz */
+	       for(i=0;i<enkf_subvecsize;i++){
+		 arr_aniso_perm_yy[i] = subvec_permy[i] / subvec_param[i];
+		 arr_aniso_perm_zz[i] = subvec_permz[i] / subvec_param[i];
+	       }
+	       aniso_initialized = 1;
 	     }
-	   }
-
+           }else{
+             memcpy(pf_paramvec, param_cache, pf_paramvecsize * sizeof(double));
+           }
         }
 
 }
 
 void enkfparflowfinalize() {
 
+	/* write remaining output before freeing the state arrays */
+	printstat_parflow_finish();
+	enkf_ensemblestatistics_free();
+	enkf_output_finalize();
+
 	free(subvec_p);
 	free(subvec_sat);
 	free(subvec_porosity);
 	free(subvec_param);
+	free(param_cache);
+	free(param_keep);
+	free(param_stat);
 	free(subvec_mean);
 	free(subvec_sd);
 	free(subvec_param_mean);
@@ -907,6 +907,10 @@ void enkfparflowfinalize() {
 
 	free(subvec_permy);
 	free(subvec_permz);
+	free(river_cells);
+	free(gw_stat);
+	enkf_mask_free(&gw_saturated);
+	enkf_mask_free(&gw_unsaturated);
 	free(arr_aniso_perm_yy);
 	free(arr_aniso_perm_zz);
 
@@ -948,435 +952,926 @@ int enkf_getsubvectorsize(Grid *grid) {
 
 /*-------------------------------------------------------------------------*/
 /**
-  @author   Wolfgang Kurtz, Guowei He, Mukund Pondkule
-  @brief    Populate C-array (part of state vector) from ParFlow type Vector.
-  @param    pf_vector    ParFlow Vector containing data.
-  @param    enkf_subvec   C-array to be populated.
-
-  Remark:
-  -------
-
-  `pf_vector` needs to be extracted from the ParFlow problem.
-
-  Example 1: `pf_vector` extracted as output of `AdvanceRichards` and
-  after `InitVectorUpdate` and `FinalizeVectorUpdate`, as is the case
-  for pressures, saturation and porosity.
-
-  Example 2: `pf_vector` extracted as `ProblemDataPermeabilityX` or
-  similar.
-
-  Workflow:
-  ---------
-  1. Obtain the grid information from ParFlow Vector.
-  2. Iterate over the subgrids of `grid`
-  3. Get SubvectorData corresponding to subgrid
-  4. Populate `enkf_subvec` with SubvectorData
+  @brief    Subgrid table of a ParFlow grid.
+  @param    grid        ParFlow grid.
+  @param    nsubgrids   Number of subgrids of this rank (output).
+  @return   Table of subgrids with offset of the first cell in the state arrays.
+
+  The subgrids of a rank are stored one after the other in the state
+  arrays, each subgrid in ParFlow order (x fastest, then y, then z).
+  The table is built at the first call for a grid and kept until the
+  end of the simulation.
  */
 /*--------------------------------------------------------------------------*/
-void PF2ENKF(Vector *pf_vector, double *enkf_subvec) {
+enkf_subgrid *enkf_subgrid_table(Grid *grid, int *nsubgrids) {
+	static Grid         *table_grid[ENKF_MAX_GRIDS];
+	static enkf_subgrid *table[ENKF_MAX_GRIDS];
+	static int          table_size[ENKF_MAX_GRIDS];
+	static int          ntables = 0;
+	int t, sg;
+	int offset = 0;
+	int row = 0;
+
+	for(t=0;t<ntables;t++){
+		if(table_grid[t] == grid){
+			*nsubgrids = table_size[t];
+			return table[t];
+		}
+	}
 
-        /* Obtain grid information from `pf_vector` */
-	Grid *grid = VectorGrid(pf_vector);
-	int sg;
+	if(ntables == ENKF_MAX_GRIDS){
+		printf("Error: enkf_subgrid_table: more than %d grids\n", ENKF_MAX_GRIDS);
+		exit(1);
+	}
+
+	table_grid[ntables] = grid;
+	table_size[ntables] = SubgridArraySize(GridSubgrids(grid));
+	table[ntables] = (enkf_subgrid *) malloc(table_size[ntables] * sizeof(enkf_subgrid));
 
-	/* Iterate over subgrids */
 	ForSubgridI(sg, GridSubgrids(grid))
 	{
-                /* Subgrid instance  */
 		Subgrid *subgrid = GridSubgrid(grid, sg);
+		enkf_subgrid *s = &table[ntables][sg];
+
+		s->ix = SubgridIX(subgrid);
+		s->iy = SubgridIY(subgrid);
+		s->iz = SubgridIZ(subgrid);
+		s->nx = SubgridNX(subgrid);
+		s->ny = SubgridNY(subgrid);
+		s->nz = SubgridNZ(subgrid);
+		s->offset = offset;
+		s->row = row;
+		offset += s->nx * s->ny * s->nz;
+		row += s->ny * s->nz;
+	}
 
-		/* Bottom-lower-left corner of subgrid */
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+	*nsubgrids = table_size[ntables];
+	return table[ntables++];
+}
 
-		/* Size of subgrid */
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Index in the state arrays of a global grid cell.
+  @param    i   Global x-index (0-based).
+  @param    j   Global y-index (0-based).
+  @param    k   Global z-index (0-based).
+  @return   Index of cell (i,j,k), -1 if the cell is not on this rank.
+ */
+/*--------------------------------------------------------------------------*/
+int enkf_subgrid_index(int i, int j, int k) {
+	int sg;
+	for(sg=0;sg<enkf_nsubgrids;sg++){
+		enkf_subgrid *s = &enkf_subgrids[sg];
+		if(i >= s->ix && i < s->ix + s->nx && j >= s->iy && j < s->iy + s->ny && k >= s->iz && k < s->iz + s->nz){
+			return s->offset + ((k - s->iz) * s->ny + (j - s->iy)) * s->nx + (i - s->ix);
+		}
+	}
+	return -1;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Index in the state arrays of a global state index.
+  @param    idx   Global index `nx_glob*ny_glob*k + nx_glob*j + i + 1`,
+                  as in `idx_map_subvec2state`.
+  @return   Index in the state arrays (1-based), 0 if the cell is not
+            on this rank.
+
+  Inverse of `idx_map_subvec2state` for the observation operators,
+  called from Fortran.
+ */
+/*--------------------------------------------------------------------------*/
+int enkf_parflow_state_index(int idx) {
+	int i, j, k;
+
+	idx -= 1;
+	if(idx < 0 || idx >= nx_glob * ny_glob * nz_glob) return 0;
+	i = idx % nx_glob;
+	j = (idx / nx_glob) % ny_glob;
+	k = idx / (nx_glob * ny_glob);
+	return enkf_subgrid_index(i, j, k) + 1;
+}
 
-		/* if (screen_wrapper > 2) { */
-		/*   printf("TSMP-PDAF-WRAPPER mype(w)=%5d: sg, ix, iy, iz, nx, ny, nz = %d, %d, %d, %d, %d, %d, %d, \n", mype_world, sg, ix, iy, iz, nx, ny, nz); */
-		/* } */
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Build the index list of the cells where `values` equals `active`.
+  @param    mask     Index list (output, previous lists are reused).
+  @param    values   Array on the state grid (`enkf_subvecsize`).
+  @param    active   Value of the active cells.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_mask_build(enkf_mask *mask, double *values, double active) {
+	int sg, r, i, j, nrows = 0, nruns = 0;
 
-		/* (1) Access the Subvector inside `pf_vector` that
-		   corresponds to grid `sg`, (2) Access data array
-		   from this Subvector instance */
-		Subvector *subvector = VectorSubvector(pf_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+	for(sg=0;sg<enkf_nsubgrids;sg++) nrows += enkf_subgrids[sg].ny * enkf_subgrids[sg].nz;
 
-		/* Iterate subgrid's cells */
-		int i, j, k;
-		int counter = 0;
-		/* TODO: `counter` is reset to zero for each
-		   subgrid-iteration. However, for multiple subgrids
-		   in the loop this would overwrite the values in
-		   enkf_subvec. So, this code is possibly only working
-		   for a single subgrid. */
+	if(mask->row_ptr == NULL || mask->nrows != nrows){
+		free(mask->row_ptr);
+		mask->row_ptr = (int*) calloc(nrows + 1, sizeof(int));
+		mask->nrows = nrows;
+	}
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-					enkf_subvec[counter] = (subvector_data[pf_index]);
-					counter++;
+	/* 1. count the runs of each row */
+	for(sg=0;sg<enkf_nsubgrids;sg++){
+		enkf_subgrid *s = &enkf_subgrids[sg];
+		for(r=0;r<s->ny*s->nz;r++){
+			double *v = values + s->offset + r * s->nx;
+			int n = 0;
+			for(i=0;i<s->nx;i++){
+				if(v[i] == active && (i == 0 || v[i-1] != active)) n++;
+			}
+			mask->row_ptr[s->row + r + 1] = n;
+		}
+	}
+	mask->row_ptr[0] = 0;
+	for(r=0;r<nrows;r++) mask->row_ptr[r+1] += mask->row_ptr[r];
+	nruns = mask->row_ptr[nrows];
+
+	mask->run_start = (int*) realloc(mask->run_start, (nruns + 1) * sizeof(int));
+	mask->run_len = (int*) realloc(mask->run_len, (nruns + 1) * sizeof(int));
+	if(mask->run_start == NULL || mask->run_len == NULL){
+		printf("Error: could not allocate index list of mask (%d runs)\n", nruns);
+		exit(1);
+	}
+	mask->nruns = nruns;
+
+	/* 2. fill the runs */
+	for(sg=0;sg<enkf_nsubgrids;sg++){
+		enkf_subgrid *s = &enkf_subgrids[sg];
+		for(r=0;r<s->ny*s->nz;r++){
+			int idx = s->offset + r * s->nx;
+			int n = mask->row_ptr[s->row + r];
+			for(i=0;i<s->nx;i=j){
+				if(values[idx + i] != active){
+					j = i + 1;
+					continue;
 				}
+				for(j=i;j<s->nx && values[idx + j] == active;j++);
+				mask->run_start[n] = idx + i;
+				mask->run_len[n] = j - i;
+				n++;
 			}
 		}
 	}
 }
 
-void PF2ENKF_2P(Vector *p1_vector, Vector *p2_vector, double *enkf_subvec) {
-
-	Grid *grid = VectorGrid(p1_vector);
-	int sg;
-
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
-
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Free an index list built by `enkf_mask_build`.
+  @param    mask   Index list.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_mask_free(enkf_mask *mask) {
+	free(mask->row_ptr);
+	free(mask->run_start);
+	free(mask->run_len);
+	mask->row_ptr = NULL;
+	mask->run_start = NULL;
+	mask->run_len = NULL;
+	mask->nrows = 0;
+	mask->nruns = 0;
+}
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Range of cells in the uppermost `pf_olfmasking_depth` layers.
+  @param    s       Subgrid.
+  @param    start   First cell of the range in the state arrays (output).
+  @param    end     End of the range (output, `start == end` if the
+                    subgrid does not contain any uppermost layer).
+
+  The uppermost layers of a subgrid are stored contiguously at the
+  end of its block in the state arrays.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_subgrid_toplayers(enkf_subgrid *s, int *start, int *end) {
+	int ktop = nz_glob - pf_olfmasking_depth;
+	if(ktop < s->iz) ktop = s->iz;
+	if(ktop > s->iz + s->nz) ktop = s->iz + s->nz;
+	*start = s->offset + (ktop - s->iz) * s->nx * s->ny;
+	*end = s->offset + s->nz * s->nx * s->ny;
+}
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Update ghost cells of several ParFlow Vectors.
+  @param    vectors    ParFlow Vectors.
+  @param    nvectors   Number of Vectors (at most ENKF_MAX_UPDATE).
 
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+  All exchanges are started before the first one is finished, so that
+  the communication of the Vectors overlaps.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_vector_update(Vector **vectors, int nvectors) {
+	VectorUpdateCommHandle *handle[ENKF_MAX_UPDATE];
+	int v;
 
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
+	if(nvectors > ENKF_MAX_UPDATE){
+		printf("Error: enkf_vector_update: more than %d Vectors\n", ENKF_MAX_UPDATE);
+		exit(1);
+	}
+	for(v=0;v<nvectors;v++) handle[v] = InitVectorUpdate(vectors[v], VectorUpdateAll);
+	for(v=0;v<nvectors;v++) FinalizeVectorUpdate(handle[v]);
+}
 
-		int i, j, k;
-		int counter = 0;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Apply transform of a state field (ParFlow value -> state value).
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_transform_row(double *v, int n, int stride, int transform) {
+	int i;
+	if(transform == ENKF_TRANSFORM_LOG10){
+		for(i=0;i<n;i++) v[i*stride] = log10(v[i*stride]);
+	}
+	else if(transform == ENKF_TRANSFORM_LOG){
+		for(i=0;i<n;i++) v[i*stride] = log(v[i*stride]);
+	}
+}
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-					enkf_subvec[counter] = (subvector_data[pf_index]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_2_data[pf_index_2]);
-					counter++;
-				}
-			}
-		}
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Inverse transform of a contiguous part of a state field.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_backtransform_row(double *v, int n, int transform) {
+	int i;
+	if(transform == ENKF_TRANSFORM_LOG10){
+		for(i=0;i<n;i++) v[i] = pow(10,v[i]);
 	}
+	else if(transform == ENKF_TRANSFORM_LOG){
+		for(i=0;i<n;i++) v[i] = exp(v[i]);
+	}
+}
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Inverse transform of a state field (state value -> ParFlow value).
+ */
+/*--------------------------------------------------------------------------*/
+static double enkf_backtransform(double v, int transform) {
+	if(transform == ENKF_TRANSFORM_LOG10) return pow(10,v);
+	if(transform == ENKF_TRANSFORM_LOG) return exp(v);
+	return v;
 }
 
-void PF2ENKF_3P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, double *enkf_subvec) {
+/*-------------------------------------------------------------------------*/
+/**
+  @author   Wolfgang Kurtz, Guowei He, Mukund Pondkule
+  @brief    Populate C-arrays (parts of state vector) from ParFlow Vectors.
+  @param    fields    Table of `nfields` field descriptors (see `enkf_field`).
+  @param    nfields   Number of fields.
 
-	Grid *grid = VectorGrid(p1_vector);
-	int sg;
+  Remark:
+  -------
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
+  The ParFlow Vectors need to be extracted from the ParFlow problem.
 
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+  Example 1: Vectors extracted as output of `AdvanceRichards`, as is
+  the case for pressures, saturation and porosity.
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+  Only owned cells are read, ghost cells do not need to be updated
+  before the gather.
 
+  Example 2: Vectors extracted as `ProblemDataPermeabilityX` or
+  similar.
 
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+  All fields must live on the same grid.
 
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
+  Workflow:
+  ---------
+  1. Obtain the subgrid table of the grid of the first ParFlow Vector.
+  2. Iterate over the subgrids in parallel (OpenMP); subgrid `sg`
+     starts at `offset` in the state arrays.
+  3. Iterate over the x-rows of the subgrid; in a Subvector each
+     x-row is contiguous.
+  4. For each field, copy the row into `state` (`memcpy` for a
+     contiguous field without transform), multiply by `product`,
+     store the plain ParFlow values in `raw` and apply `transform`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_gather(enkf_field *fields, int nfields) {
 
-                Subvector *subvector_3 = VectorSubvector(p3_vector, sg);
-		double *subvector_3_data = SubvectorData(subvector_3);
+	int nsubgrids;
+	enkf_subgrid *subgrids = enkf_subgrid_table(VectorGrid(fields[0].vector), &nsubgrids);
+	int sg;
 
-		int i, j, k;
-		int counter = 0;
+	/* Iterate over subgrids, each subgrid fills its own block of
+	   the state arrays */
+#pragma omp parallel for schedule(dynamic)
+	for (sg = 0; sg < nsubgrids; sg++)
+	{
+		/* Bottom-lower-left corner and size of subgrid */
+		int ix = subgrids[sg].ix;
+		int iy = subgrids[sg].iy;
+		int iz = subgrids[sg].iz;
+		int nx = subgrids[sg].nx;
+		int ny = subgrids[sg].ny;
+		int nz = subgrids[sg].nz;
+
+		int f, i, j, k;
+		int counter = subgrids[sg].offset;
 
 		for (k = iz; k < iz + nz; k++) {
 			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-                                        int pf_index_3 = SubvectorEltIndex(subvector_3, i, j, k);
-					enkf_subvec[counter] = (subvector_data[pf_index]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_2_data[pf_index_2]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_3_data[pf_index_3]);
-					counter++;
+				for (f = 0; f < nfields; f++) {
+					enkf_field *field = &fields[f];
+					int stride = field->stride;
+
+					/* Start of x-row in the Subvector */
+					Subvector *subvector = VectorSubvector(field->vector, sg);
+					double *src = SubvectorData(subvector) + SubvectorEltIndex(subvector, ix, j, k);
+					double *dst = field->state + counter * stride;
+
+					if(field->raw != NULL){
+						double *raw = field->raw + counter * stride;
+						for (i = 0; i < nx; i++) raw[i*stride] = src[i];
+					}
+
+					if(field->product != NULL){
+						Subvector *subvector_prod = VectorSubvector(field->product, sg);
+						double *prod = SubvectorData(subvector_prod) + SubvectorEltIndex(subvector_prod, ix, j, k);
+						for (i = 0; i < nx; i++) dst[i*stride] = src[i] * prod[i];
+					}
+					else if(stride == 1){
+						memcpy(dst, src, nx * sizeof(double));
+					}
+					else{
+						for (i = 0; i < nx; i++) dst[i*stride] = src[i];
+					}
+
+					enkf_transform_row(dst, nx, stride, field->transform);
 				}
+				counter += nx;
 			}
 		}
 	}
-
 }
 
-void PF2ENKF_4P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, Vector *p4_vector, double *enkf_subvec) {
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write C-arrays (parts of state vector) to ParFlow Vectors.
+  @param    fields    Table of `nfields` field descriptors (see `enkf_field`).
+  @param    nfields   Number of fields.
+
+  Inverse of `enkf_gather`. For each cell, the state value is
+  back-transformed, multiplied by `scale` and `factor` and divided by
+  `product`. If `mask` is set, the result is blended with the current
+  ParFlow value: `mask*value + (1-mask)*current`. If `index` is set,
+  only its cells are written to ParFlow.
+
+  If `forecast` is set, the analysis is post-processed in the same
+  pass: damping against the forecast, storing the damped value in
+  `stat` (ensemble statistics), back-transform,
+  clamping to [`vmin`,`vmax`] and replacing by the untransformed
+  forecast `raw` where `keep` is one. The final value is written to
+  the state array as well, so that fields later in the table (same
+  state array) see the post-processed value. The post-processing
+  covers all cells, also those not in `index`.
+
+  Contiguous fields without any of these operations are copied row
+  by row with `memcpy`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_scatter(enkf_field *fields, int nfields) {
 
-	Grid *grid = VectorGrid(p1_vector);
+	int nsubgrids;
+	enkf_subgrid *subgrids = enkf_subgrid_table(VectorGrid(fields[0].vector), &nsubgrids);
 	int sg;
 
-	ForSubgridI(sg, GridSubgrids(grid))
+#pragma omp parallel for schedule(dynamic)
+	for (sg = 0; sg < nsubgrids; sg++)
 	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
-
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
-
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
-
-
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
-
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
-
-                Subvector *subvector_3 = VectorSubvector(p3_vector, sg);
-		double *subvector_3_data = SubvectorData(subvector_3);
-
-                Subvector *subvector_4 = VectorSubvector(p4_vector, sg);
-		double *subvector_4_data = SubvectorData(subvector_4);
+		int ix = subgrids[sg].ix;
+		int iy = subgrids[sg].iy;
+		int iz = subgrids[sg].iz;
+		int nx = subgrids[sg].nx;
+		int ny = subgrids[sg].ny;
+		int nz = subgrids[sg].nz;
 
-		int i, j, k;
-		int counter = 0;
+		int f, i, j, k;
+		int counter = subgrids[sg].offset;
+		int row = subgrids[sg].row;
 
 		for (k = iz; k < iz + nz; k++) {
 			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-                                        int pf_index_3 = SubvectorEltIndex(subvector_3, i, j, k);
-                                        int pf_index_4 = SubvectorEltIndex(subvector_4, i, j, k);
-					enkf_subvec[counter] = (subvector_data[pf_index]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_2_data[pf_index_2]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_3_data[pf_index_3]);
-					counter++;
-                                        enkf_subvec[counter] = (subvector_4_data[pf_index_4]);
-					counter++;
+				for (f = 0; f < nfields; f++) {
+					enkf_field *field = &fields[f];
+					int stride = field->stride;
+
+					Subvector *subvector = VectorSubvector(field->vector, sg);
+					double *dst = SubvectorData(subvector) + SubvectorEltIndex(subvector, ix, j, k);
+					double *src = field->state + counter * stride;
+					int plain = stride == 1 && field->transform == ENKF_TRANSFORM_NONE && field->scale == 1.0
+					   && field->factor == NULL && field->product == NULL && field->mask == NULL
+					   && field->forecast == NULL && field->keep == NULL
+					   && field->vmin == -HUGE_VAL && field->vmax == HUGE_VAL;
+
+					/* cells of the x-row to write: all, or the runs of
+					   active cells of `index`. With post-processing, all
+					   cells are processed and the runs only select the
+					   cells written to ParFlow (`run`, `rend`). */
+					int runs = field->index != NULL && field->forecast == NULL;
+					int r, i0, i1, rfirst = 0, rlast = 1, run = 0, rend = 0;
+					if(runs){
+						rfirst = field->index->row_ptr[row];
+						rlast = field->index->row_ptr[row + 1];
+					}
+					else if(field->index != NULL){
+						run = field->index->row_ptr[row];
+						rend = field->index->row_ptr[row + 1];
+					}
+
+					double *prod = NULL;
+					if(field->product != NULL){
+						Subvector *subvector_prod = VectorSubvector(field->product, sg);
+						prod = SubvectorData(subvector_prod) + SubvectorEltIndex(subvector_prod, ix, j, k);
+					}
+
+					for (r = rfirst; r < rlast; r++) {
+						i0 = 0;
+						i1 = nx;
+						if(runs){
+							i0 = field->index->run_start[r] - counter;
+							i1 = i0 + field->index->run_len[r];
+						}
+
+						if(plain){
+							memcpy(dst + i0, src + i0, (i1 - i0) * sizeof(double));
+							continue;
+						}
+
+						for (i = i0; i < i1; i++) {
+							double v = src[i*stride];
+
+							/* analysis post-processing: damping, statistics,
+							   back-transform, clamping, masking; the final value
+							   is stored in the state array */
+							if(field->forecast != NULL){
+								double fc = field->forecast[(counter + i) * stride];
+								v = fc + field->dampfac * (v - fc);
+								if(field->stat != NULL) field->stat[counter + i] = v;
+							}
+							v = enkf_backtransform(v, field->transform);
+							if(v < field->vmin) v = field->vmin;
+							if(v > field->vmax) v = field->vmax;
+							if(field->keep != NULL && field->keep[counter + i] > 0.5) v = field->raw[(counter + i) * stride];
+							if(field->forecast != NULL) src[i*stride] = v;
+
+							if(field->index != NULL && !runs){
+								while(run < rend && i >= field->index->run_start[run] - counter + field->index->run_len[run]) run++;
+								if(run == rend || i < field->index->run_start[run] - counter) continue;
+							}
+
+							v *= field->scale;
+							if(field->factor != NULL) v *= field->factor[counter + i];
+							if(prod != NULL) v /= prod[i];
+							if(field->mask != NULL) v = field->mask[counter + i] * v + (1.0 - field->mask[counter + i]) * dst[i];
+							dst[i] = v;
+						}
+					}
 				}
+				counter += nx;
+				row++;
 			}
 		}
 	}
+}
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Set a field descriptor to plain copy of contiguous data.
+  @param    field       Field descriptor to be set.
+  @param    pf_vector   ParFlow Vector.
+  @param    state       State array.
+  @param    stride      Distance of consecutive cells in `state`.
+  @param    transform   ENKF_TRANSFORM_*.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_field_set(enkf_field *field, Vector *pf_vector, double *state, int stride, int transform) {
+	field->vector = pf_vector;
+	field->state = state;
+	field->stride = stride;
+	field->transform = transform;
+	field->raw = NULL;
+	field->product = NULL;
+	field->factor = NULL;
+	field->scale = 1.0;
+	field->mask = NULL;
+	field->index = NULL;
+	field->forecast = NULL;
+	field->dampfac = 1.0;
+	field->stat = NULL;
+	field->vmin = -HUGE_VAL;
+	field->vmax = HUGE_VAL;
+	field->keep = NULL;
 }
 
-void ENKF2PF(Vector *pf_vector, double *enkf_subvec) {
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Populate C-array (part of state vector) from ParFlow type Vector.
+  @param    pf_vector    ParFlow Vector containing data.
+  @param    enkf_subvec   C-array to be populated.
 
-	Grid *grid = VectorGrid(amps_ThreadLocal(pf_vector));
-	int sg;
+  Single-field version of `enkf_gather`.
+ */
+/*--------------------------------------------------------------------------*/
+void PF2ENKF(Vector *pf_vector, double *enkf_subvec) {
+	enkf_field field;
+	enkf_field_set(&field, pf_vector, enkf_subvec, 1, ENKF_TRANSFORM_NONE);
+	enkf_gather(&field, 1);
+}
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write C-array (part of state vector) to ParFlow type Vector.
+  @param    pf_vector    ParFlow Vector to be populated.
+  @param    enkf_subvec   C-array containing data.
 
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+  Single-field version of `enkf_scatter`.
+ */
+/*--------------------------------------------------------------------------*/
+void ENKF2PF(Vector *pf_vector, double *enkf_subvec) {
+	enkf_field field;
+	enkf_field_set(&field, pf_vector, enkf_subvec, 1, ENKF_TRANSFORM_NONE);
+	enkf_scatter(&field, 1);
+}
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write C-array to ParFlow type Vector where `mask` is one.
+  @param    pf_vector    ParFlow Vector to be populated.
+  @param    enkf_subvec   C-array containing data.
+  @param    mask         Mask array (1.0: update, 0.0: keep ParFlow value).
+ */
+/*--------------------------------------------------------------------------*/
+void ENKF2PF_masked(Vector *pf_vector, double *enkf_subvec, double *mask) {
+	enkf_field field;
+	enkf_field_set(&field, pf_vector, enkf_subvec, 1, ENKF_TRANSFORM_NONE);
+	field.mask = mask;
+	enkf_scatter(&field, 1);
+}
 
-		Subvector *subvector = VectorSubvector(pf_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write C-array to ParFlow type Vector in the cells of `mask`.
+  @param    pf_vector    ParFlow Vector to be populated.
+  @param    enkf_subvec   C-array containing data.
+  @param    mask         Index list of the cells to update.
 
-		int i, j, k;
-		int counter = 0;
+  Same result as `ENKF2PF_masked` with a 0/1 mask, but inactive
+  cells are skipped instead of blended.
+ */
+/*--------------------------------------------------------------------------*/
+void ENKF2PF_indexed(Vector *pf_vector, double *enkf_subvec, enkf_mask *mask) {
+	enkf_field field;
+	enkf_field_set(&field, pf_vector, enkf_subvec, 1, ENKF_TRANSFORM_NONE);
+	field.index = mask;
+	enkf_scatter(&field, 1);
+}
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-					(subvector_data[pf_index]) = enkf_subvec[counter];
-					counter++;
-				}
-			}
-		}
-	}
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Populate C-array with soil water content from ParFlow Vectors.
+  @param    sat_vector    ParFlow Vector containing saturation.
+  @param    poro_vector   ParFlow Vector containing porosity.
+  @param    enkf_subvec   C-array to be populated.
+
+  Product of saturation and porosity in one pass without
+  intermediate arrays.
+ */
+/*--------------------------------------------------------------------------*/
+void PF2ENKF_swc(Vector *sat_vector, Vector *poro_vector, double *enkf_subvec) {
+	enkf_field field;
+	enkf_field_set(&field, sat_vector, enkf_subvec, 1, ENKF_TRANSFORM_NONE);
+	field.product = poro_vector;
+	enkf_gather(&field, 1);
 }
 
-void ENKF2PF_2P(Vector *p1_vector, Vector *p2_vector, double *enkf_subvec) {
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Add a block to the state vector layout.
+  @param    name        Name of the field in output files.
+  @param    pf_vector   ParFlow Vector of the field.
+  @param    transform   ENKF_TRANSFORM_* applied in the state vector.
+  @param    dampfac     Damping factor of the analysis increment.
+  @param    dim         2: surface field, 3: subsurface field.
+  @param    mask        ENKF_MASK_* rule for the write-back.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_parflow_add_block(char *name, Vector *pf_vector, int transform, double *dampfac, int dim, int mask) {
+	enkf_block *block = &pf_blocks[pf_nblocks];
 
-	Grid *grid = VectorGrid(amps_ThreadLocal(p1_vector));
-	int sg;
+	if(pf_nblocks == ENKF_MAX_BLOCKS){
+		printf("Error: enkf_parflow_add_block: more than %d blocks\n", ENKF_MAX_BLOCKS);
+		exit(1);
+	}
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
+	strncpy(block->name, name, sizeof(block->name) - 1);
+	block->name[sizeof(block->name) - 1] = '\0';
+	block->vector = pf_vector;
+	block->transform = transform;
+	block->dampfac = dampfac;
+	block->dim = dim;
+	block->mask = mask;
+	block->vmin = -HUGE_VAL;
+	block->vmax = HUGE_VAL;
+	block->size = enkf_getsubvectorsize(VectorGrid(pf_vector));
+	block->offset = 0;
+	if(pf_nblocks > 0) block->offset = pf_blocks[pf_nblocks-1].offset + pf_blocks[pf_nblocks-1].size;
+
+	pf_nblocks++;
+}
 
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Set the layout of the ParFlow state vector.
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+  The state vector consists of contiguous blocks, one per field:
 
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+  1. model state: pressure (`pf_updateflag` 1), soil water content
+     (`pf_updateflag` 2) or soil water content and pressure
+     (`pf_updateflag` 3)
+  2. parameters (`pf_paramupdate`): hydraulic conductivity,
+     Mannings coefficient, porosity, van Genuchten alpha and n
 
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
+  Sets `pf_blocks`, `pf_nstateblocks`, `pf_nblocks`,
+  `pf_statevecsize` and `pf_paramvecsize`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_parflow_init_blocks() {
+	ProblemData *problem_data = GetProblemDataRichards(solver);
+	PFModule    *relPerm = GetPhaseRelPerm(solver);
+	int         b;
 
-		int i, j, k;
-		int counter = 0;
+	pf_nblocks = 0;
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-					(subvector_data[pf_index]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_2_data[pf_index_2]) = enkf_subvec[counter];
-					counter++;
-				}
-			}
-		}
+	/* model state */
+	if(pf_updateflag == 1){
+		enkf_parflow_add_block("press", GetPressureRichards(solver), ENKF_TRANSFORM_NONE, &pf_dampfac_state, 3, ENKF_MASK_NONE);
 	}
-}
+	if(pf_updateflag == 2 || pf_updateflag == 3){
+		enkf_parflow_add_block("swc", GetSaturationRichards(solver), ENKF_TRANSFORM_NONE, &pf_dampfac_state, 3, ENKF_MASK_NONE);
+	}
+	if(pf_updateflag == 3){
+		enkf_parflow_add_block("press", GetPressureRichards(solver), ENKF_TRANSFORM_NONE, &pf_dampfac_state, 3, ENKF_MASK_NONE);
+	}
+	pf_nstateblocks = pf_nblocks;
 
-void ENKF2PF_3P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, double *enkf_subvec) {
+	/* parameters */
+	if(pf_paramupdate == 1){
+		enkf_parflow_add_block("ksat", ProblemDataPermeabilityX(problem_data), ENKF_TRANSFORM_LOG10, &pf_dampfac_param, 3, ENKF_MASK_GW | ENKF_MASK_OLF);
+	}
+	if(pf_paramupdate == 5 || pf_paramupdate == 6 || pf_paramupdate == 8){
+		enkf_parflow_add_block("ksat", ProblemDataPermeabilityX(problem_data), ENKF_TRANSFORM_LOG10, &pf_dampfac_param, 3, ENKF_MASK_NONE);
+	}
+	if(pf_paramupdate == 2){
+		enkf_parflow_add_block("mannings", ProblemDataMannings(problem_data), ENKF_TRANSFORM_LOG10, &pf_dampfac_param, 2, ENKF_MASK_NONE);
+	}
+	if(pf_paramupdate == 3 || pf_paramupdate == 5 || pf_paramupdate == 7 || pf_paramupdate == 8){
+		enkf_parflow_add_block("poro", ProblemDataPorosity(problem_data), ENKF_TRANSFORM_NONE, &pf_dampfac_param, 3, ENKF_MASK_NONE);
+		pf_blocks[pf_nblocks-1].vmin = 0.0;
+		pf_blocks[pf_nblocks-1].vmax = 1.0;
+		param_writeback_first = 1;
+	}
+	if(pf_paramupdate == 4 || pf_paramupdate == 6 || pf_paramupdate == 7 || pf_paramupdate == 8){
+		enkf_parflow_add_block("alpha", PhaseRelPermGetAlpha(relPerm), ENKF_TRANSFORM_LOG, &pf_dampfac_param, 3, ENKF_MASK_NONE);
+		enkf_parflow_add_block("n", PhaseRelPermGetN(relPerm), ENKF_TRANSFORM_NONE, &pf_dampfac_param, 3, ENKF_MASK_NONE);
+		pf_blocks[pf_nblocks-1].vmin = 1.0;
+	}
 
-	Grid *grid = VectorGrid(amps_ThreadLocal(p1_vector));
-	int sg;
+	pf_statevecsize = 0;
+	pf_paramvecsize = 0;
+	for(b=0;b<pf_nblocks;b++){
+		pf_statevecsize += pf_blocks[b].size;
+		if(b >= pf_nstateblocks) pf_paramvecsize += pf_blocks[b].size;
+	}
+}
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Field table of the parameter blocks of the state vector.
+  @param    fields   Field table to be set (at least `pf_nblocks` entries).
+  @param    state    Start of the parameter part of the state vector.
+  @return   Number of parameter fields.
 
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+  Untransformed values are stored in `subvec_param` with the same
+  layout as the parameter part of the state vector.
+ */
+/*--------------------------------------------------------------------------*/
+int enkf_parflow_paramfields(enkf_field *fields, double *state) {
+	int poff = pf_statevecsize - pf_paramvecsize;
+	int b, f;
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+	for(b=pf_nstateblocks,f=0;b<pf_nblocks;b++,f++){
+		enkf_field_set(&fields[f], pf_blocks[b].vector, state + (pf_blocks[b].offset - poff), 1, pf_blocks[b].transform);
+		fields[f].raw = subvec_param + (pf_blocks[b].offset - poff);
+	}
 
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
+	return f;
+}
 
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Post-process updated parameters and write them to ParFlow.
+  @param    nshift   Offset of the parameters in `pf_statevec`.
+
+  One pass over all parameter blocks (`enkf_scatter`) does the
+  damping against the cached forecast, collects the values for the
+  ensemble statistics, back-transforms, clamps (`PF:paramclamp`),
+  applies groundwater and overland flow masking and writes to ParFlow.
+  The dependent ParFlow Vectors are set in the same pass: perm_yy/
+  perm_zz from perm_xx and the anisotropy factors, alpha/n of the
+  saturation module.
+
+  Afterwards, `pf_statevec` holds the back-transformed parameters.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_parflow_update_param(int nshift) {
+	ProblemData *problem_data = GetProblemDataRichards(solver);
+	PFModule    *relPerm = GetPhaseRelPerm(solver);
+	PFModule    *sat     = GetSaturation(solver);
+	Vector      *perm_xx  = ProblemDataPermeabilityX(problem_data);
+	Vector      *porosity = ProblemDataPorosity(problem_data);
+	Vector      *alpha    = PhaseRelPermGetAlpha(relPerm);
+	Vector      *n        = PhaseRelPermGetN(relPerm);
+	Vector      *vectors[ENKF_MAX_UPDATE];
+	enkf_field  fields[ENKF_MAX_UPDATE];
+	int         poff = pf_statevecsize - pf_paramvecsize;
+	int         nparam, nfields, f, i, sg, start, end;
+	char        name[100];
+
+	/* overland flow masking of parameters: keep forecast in the
+	   uppermost model layers */
+	if(pf_olfmasking_param == 1 || pf_olfmasking_param == 3){
+	  if(pf_olfmasking == 3 && pf_updateflag != 1 && pf_updateflag != 3){
+	    printf("Error (update_parflow): pf_olfmasking_param = 3 requires pf_updateflag = 1 or 3\n");
+	    exit(1);
+	  }
+	  memset(param_keep, 0, pf_paramvecsize * sizeof(double));
+	  for(sg=0;sg<enkf_nsubgrids;sg++){
+	    enkf_subgrid_toplayers(&enkf_subgrids[sg], &start, &end);
+	    for(i=start;i<end;i++){
+	      if(pf_olfmasking == 1 || (pf_olfmasking == 3 && subvec_p[i]>0.0)) param_keep[i] = 1.0;
+	    }
+	  }
+	}
 
-                Subvector *subvector_3 = VectorSubvector(p3_vector, sg);
-		double *subvector_3_data = SubvectorData(subvector_3);
+	nparam = enkf_parflow_paramfields(fields, &pf_statevec[nshift]);
+	nfields = nparam;
 
-		int i, j, k;
-		int counter = 0;
+	for(f=0;f<nparam;f++){
+		enkf_block *block = &pf_blocks[pf_nstateblocks+f];
+		enkf_field *field = &fields[f];
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-                                        int pf_index_3 = SubvectorEltIndex(subvector_3, i, j, k);
-					(subvector_data[pf_index]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_2_data[pf_index_2]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_3_data[pf_index_3]) = enkf_subvec[counter];
-					counter++;
-				}
+		field->forecast = &param_cache[block->offset - poff];
+		field->dampfac = *block->dampfac;
+		if(pf_paramprintstat){
+			field->stat = &param_stat[block->offset - poff];
+		}
+		if(pf_paramclamp){
+			field->vmin = block->vmin;
+			field->vmax = block->vmax;
+		}
+		if((block->mask & ENKF_MASK_GW) && pf_gwmasking > 0) field->index = &gw_saturated;
+		if((block->mask & ENKF_MASK_OLF) && (pf_olfmasking_param == 1 || pf_olfmasking_param == 3)) field->keep = param_keep;
+
+		/* dependent Vectors, copy of the final value */
+		if(field->vector == perm_xx){
+			enkf_field_set(&fields[nfields], ProblemDataPermeabilityY(problem_data), field->state, 1, ENKF_TRANSFORM_NONE);
+			if(pf_aniso_use_parflow == 1){
+				fields[nfields].factor = arr_aniso_perm_yy;
+			}else{
+				fields[nfields].scale = pf_aniso_perm_y;
+			}
+			fields[nfields++].index = field->index;
+			enkf_field_set(&fields[nfields], ProblemDataPermeabilityZ(problem_data), field->state, 1, ENKF_TRANSFORM_NONE);
+			if(pf_aniso_use_parflow == 1){
+				fields[nfields].factor = arr_aniso_perm_zz;
+			}else{
+				fields[nfields].scale = pf_aniso_perm_z;
 			}
+			fields[nfields++].index = field->index;
+		}
+		if(field->vector == alpha){
+			enkf_field_set(&fields[nfields], SaturationGetAlpha(sat), field->state, 1, ENKF_TRANSFORM_NONE);
+			fields[nfields++].index = field->index;
+		}
+		if(field->vector == n){
+			enkf_field_set(&fields[nfields], SaturationGetN(sat), field->state, 1, ENKF_TRANSFORM_NONE);
+			fields[nfields++].index = field->index;
 		}
 	}
-}
-
-void ENKF2PF_4P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, Vector *p4_vector, double *enkf_subvec) {
-
-	Grid *grid = VectorGrid(amps_ThreadLocal(p1_vector));
-	int sg;
 
-	ForSubgridI(sg, GridSubgrids(grid))
-	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
+	enkf_scatter(fields, nfields);
 
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
+	for(f=0;f<nfields;f++) vectors[f] = fields[f].vector;
+	enkf_vector_update(vectors, nfields);
 
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+	/* gather parameters again in next `enkfparflowadvance` */
+	param_dirty = 1;
 
-		Subvector *subvector = VectorSubvector(p1_vector, sg);
-		double *subvector_data = SubvectorData(subvector);
-
-                Subvector *subvector_2 = VectorSubvector(p2_vector, sg);
-		double *subvector_2_data = SubvectorData(subvector_2);
-
-                Subvector *subvector_3 = VectorSubvector(p3_vector, sg);
-		double *subvector_3_data = SubvectorData(subvector_3);
-
-                Subvector *subvector_4 = VectorSubvector(p4_vector, sg);
-		double *subvector_4_data = SubvectorData(subvector_4);
+	for(f=0;f<nparam;f++){
+		if(fields[f].vector == porosity){
+			memcpy(subvec_porosity, fields[f].state, enkf_subvecsize * sizeof(double));
+		}
+	}
 
-		int i, j, k;
-		int counter = 0;
+	/* ensemble statistics, one reduction for all blocks (and the
+	   state statistics of `printstat_parflow`), printed after the
+	   state update in `printstat_parflow_finish` */
+	if(pf_paramprintstat){
+		printstat_param_parflow_start(param_stat);
+	}
 
-		for (k = iz; k < iz + nz; k++) {
-			for (j = iy; j < iy + ny; j++) {
-				for (i = ix; i < ix + nx; i++) {
-					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-                                        int pf_index_2 = SubvectorEltIndex(subvector_2, i, j, k);
-                                        int pf_index_3 = SubvectorEltIndex(subvector_3, i, j, k);
-                                        int pf_index_4 = SubvectorEltIndex(subvector_4, i, j, k);
-					(subvector_data[pf_index]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_2_data[pf_index_2]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_3_data[pf_index_3]) = enkf_subvec[counter];
-					counter++;
-                                        (subvector_4_data[pf_index_4]) = enkf_subvec[counter];
-					counter++;
-				}
+	/* print updated parameter values */
+	if(pf_paramprintensemble){
+		for(f=0;f<nparam;f++){
+			enkf_block *block = &pf_blocks[pf_nstateblocks+f];
+			if(block->dim == 2 && pf_ensemble_output == 0){
+				char fprefix [200];
+				char fsuffix [10];
+				//sprintf(fprefix,"%s/%s.%s",outdir,pfinfile,"update.mannings");
+				sprintf(fprefix,"%s.%s",pfoutfile_ens,"update.mannings");
+				sprintf(fsuffix,"%05d",tstartcycle + stat_dumpoffset);
+				enkf_printmannings(fprefix,fsuffix);
+			}else if(block->dim == 2){
+				enkf_printensemble_pfb(fields[f].state,"update.mannings",tstartcycle + stat_dumpoffset,2);
+			}else{
+				sprintf(name,"update.param.%s",block->name);
+				enkf_printensemble_pfb(fields[f].state,name,tstartcycle + stat_dumpoffset,block->dim);
 			}
 		}
 	}
 }
 
-void ENKF2PF_masked(Vector *pf_vector, double *enkf_subvec, double *mask) {
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write analysis directly into ParFlow Vector (zero-copy mode).
+  @param    pf_vector     ParFlow Vector holding the forecast (pressure or saturation).
+  @param    poro_vector   Porosity if `pf_vector` is saturation and `enkf_subvec` is
+                          soil water content, NULL otherwise.
+  @param    enkf_subvec   Analysis (part of PDAF's state vector).
+  @param    dampfac       State damping factor.
+
+  The forecast is read from `pf_vector` itself, so that damping and
+  overland flow masking (`pf_olfmasking` 1 and 3, same as in
+  `update_parflow` / `mask_overlandcells`) need no copy of the
+  forecast state.
+ */
+/*--------------------------------------------------------------------------*/
+void ENKF2PF_analysis(Vector *pf_vector, Vector *poro_vector, double *enkf_subvec, double dampfac) {
 
-	Grid *grid = VectorGrid(pf_vector);
+	int nsubgrids;
+	enkf_subgrid *subgrids = enkf_subgrid_table(VectorGrid(pf_vector), &nsubgrids);
 	int sg;
 
-	ForSubgridI(sg, GridSubgrids(grid))
+#pragma omp parallel for schedule(dynamic)
+	for (sg = 0; sg < nsubgrids; sg++)
 	{
-		Subgrid *subgrid = GridSubgrid(grid, sg);
-
-		int ix = SubgridIX(subgrid);
-		int iy = SubgridIY(subgrid);
-		int iz = SubgridIZ(subgrid);
-
-		int nx = SubgridNX(subgrid);
-		int ny = SubgridNY(subgrid);
-		int nz = SubgridNZ(subgrid);
+		int ix = subgrids[sg].ix;
+		int iy = subgrids[sg].iy;
+		int iz = subgrids[sg].iz;
+		int nx = subgrids[sg].nx;
+		int ny = subgrids[sg].ny;
+		int nz = subgrids[sg].nz;
 
 		Subvector *subvector = VectorSubvector(pf_vector, sg);
 		double *subvector_data = SubvectorData(subvector);
 
+		Subvector *subvector_poro = NULL;
+		double *subvector_poro_data = NULL;
+		if(poro_vector != NULL){
+			subvector_poro = VectorSubvector(poro_vector, sg);
+			subvector_poro_data = SubvectorData(subvector_poro);
+		}
+
+		/* first layer masked by overland flow masking */
+		int kolf = iz + nz;
+		if(pf_olfmasking == 1 || pf_olfmasking == 3) kolf = nz_glob - pf_olfmasking_depth;
+
 		int i, j, k;
-		int counter = 0;
+		int counter = subgrids[sg].offset;
 
 		for (k = iz; k < iz + nz; k++) {
 			for (j = iy; j < iy + ny; j++) {
 				for (i = ix; i < ix + nx; i++) {
 					int pf_index = SubvectorEltIndex(subvector, i, j, k);
-					subvector_data[pf_index] = mask[counter]*enkf_subvec[counter] + (1.0-mask[counter])*subvector_data[pf_index];
+					double fc = subvector_data[pf_index];
+					double poro = 1.0;
+
+					if(poro_vector != NULL){
+						poro = subvector_poro_data[SubvectorEltIndex(subvector_poro, i, j, k)];
+						fc = fc * poro;
+					}
+
+					/* keep forecast in masked overland cells */
+					if(k >= kolf && (pf_olfmasking == 1 || poro_vector != NULL || fc > 0.0)){
+						counter++;
+						continue;
+					}
+
+					subvector_data[pf_index] = (fc + dampfac * (enkf_subvec[counter] - fc)) / poro;
 					counter++;
 				}
 			}
@@ -1384,669 +1879,524 @@ void ENKF2PF_masked(Vector *pf_vector, double *enkf_subvec, double *mask) {
 	}
 }
 
-void enkf_printvec(char *pre, char *suff, double *data, int dim) {
-  Vector *v=NULL;
-  if(dim==2){
-    v = vdummy_2d;
-  }else{
-    v = vdummy_3d;
-  }
-  Grid *grid = VectorGrid(v);
-  int sg;
-
-  ForSubgridI(sg, GridSubgrids(grid))
-  {
-    Subgrid *subgrid = GridSubgrid(grid, sg);
-    int ix = SubgridIX(subgrid);
-    int iy = SubgridIY(subgrid);
-    int iz = SubgridIZ(subgrid);
-
-    int nx = SubgridNX(subgrid);
-    int ny = SubgridNY(subgrid);
-    int nz = SubgridNZ(subgrid);
-
-    Subvector *subvector = VectorSubvector(v, sg);
-
-    double *subvector_data = SubvectorData(subvector);
-    int     i, j, k;
-    int     counter = 0;
-
-    for (k = iz; k < iz + nz; k++) {
-      for (j = iy; j < iy + ny; j++) {
-    	for (i = ix; i < ix + nx; i++) {
-    	  int pf_index = SubvectorEltIndex(subvector, i, j, k);
-    	  subvector_data[pf_index] = data[counter];
-    	  counter++;
-    	}
-      }
-    }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Collect PDAF's state vector directly from ParFlow (`PF:zerocopy`).
+  @param    state_p   PDAF's PE-local state vector (size `pf_statevecsize`).
+
+  Called from `collect_state_pdaf` instead of copying `pf_statevec`.
+  Layout is the same as the one built in `enkfparflowadvance`.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_parflow_collect_state(double *state_p) {
 
+  if(pf_updateflag == 1){
+    PF2ENKF(zc_pressure, state_p);
+  }
+  if(pf_updateflag == 2 || pf_updateflag == 3){
+    PF2ENKF_swc(zc_saturation, zc_porosity, state_p);
+  }
+  if(pf_updateflag == 3){
+    PF2ENKF(zc_pressure, &state_p[enkf_subvecsize]);
   }
 
-  WritePFBinary(pre, suff, v);
+  zc_collected = 1;
 }
 
-void enkf_printmannings(char *pre, char *suff){
-    ProblemData *problem_data = GetProblemDataRichards(solver);
-    WritePFBinary(pre,suff, ProblemDataMannings(problem_data));
-}
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write PDAF's analysis directly into ParFlow (`PF:zerocopy`).
+  @param    state_p   PDAF's PE-local state vector (size `pf_statevecsize`).
 
+  Called from `distribute_state_pdaf` instead of copying into
+  `pf_statevec`. Performs the state part of `update_parflow`:
+  damping, overland flow masking, saturation to pressure conversion
+  and ghost cell update of the pressure.
+
+  The first call (from `PDAF_get_state` during initialization) comes
+  without a preceding collect and only carries the dummy ensemble of
+  `init_ens`, so it is ignored.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_parflow_distribute_state(double *state_p) {
 
-void update_parflow () {
-  int i,j,k;
   VectorUpdateCommHandle *handle;
+  Vector *pressure_in = GetPressureRichards(solver);
 
-  int do_pupd=0;
+  if(!zc_collected) return;
+  zc_collected = 0;
 
-  /* Update damping factors if set in observation file */
-  double pf_dampfac_state_tmp;
-  double pf_dampfac_param_tmp;
-  if(is_dampfac_state_time_dependent){
-    pf_dampfac_state_tmp = pf_dampfac_state;
-    pf_dampfac_state = dampfac_state_time_dependent;
-  }
-  if(is_dampfac_param_time_dependent){
-    pf_dampfac_param_tmp = pf_dampfac_param;
-    pf_dampfac_param = dampfac_param_time_dependent;
-  }
+  /* damping factor, possibly set in observation file */
+  double dampfac = pf_dampfac_state;
+  if(is_dampfac_state_time_dependent) dampfac = dampfac_state_time_dependent;
 
-  /* state damping */
   if(pf_updateflag == 1){
-    if(pf_gwmasking == 0){
-	for(i=0;i<enkf_subvecsize;i++) pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
-    }
-    if(pf_gwmasking == 1){
-	/* Same as without groundwater mask, cells with groundwater will be handled in update_parflow */
-	for(i=0;i<enkf_subvecsize;i++) pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
-    }
-    if(pf_gwmasking == 2){
-	/* Use pressures are saturation times porosity depending on mask */
-	for(i=0;i<enkf_subvecsize;i++){
-	  if(subvec_gwind[i] == 1.0){
-	    /* State damping factor always applies for Pressure */
-	    pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
-	  }
-	  else if(subvec_gwind[i] == 0.0){
-	    if(pf_dampswitch_sm == 1){
-	      /* State damping applied to SM */
-	      pf_statevec[i] = subvec_sat[i] * subvec_porosity[i] + pf_dampfac_state * (pf_statevec[i] - subvec_sat[i] * subvec_porosity[i]);
-	    }
-	    else{
-	      /* No damping factor for SM */
-	      pf_statevec[i] = subvec_sat[i] * subvec_porosity[i] + (pf_statevec[i] - subvec_sat[i] * subvec_porosity[i]);
-	    }
-	  }
-	  else{
-	    printf("ERROR: pf_gwmasking = 2, but subvec_gwind is neither 0.0 nor 1.0\n");
-	    exit(1);
-	  }
-	}
-    }
+    ENKF2PF_analysis(pressure_in, NULL, state_p, dampfac);
   }
 
-  /* print updated ensemble */
-  if(pf_t_printensemble == tstartcycle || pf_t_printensemble < 0 ) {
-    if(pf_updateflag == 3){
-      if(pf_printensemble == 1) enkf_printstatistics_pfb(&pf_statevec[enkf_subvecsize],"update",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-    }else{
-      if(pf_printensemble == 1) enkf_printstatistics_pfb(&pf_statevec[0],"update",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-    }
+  if(pf_updateflag == 2){
+    Problem     *problem = GetProblemRichards(solver);
+    ProblemData *problem_data = GetProblemDataRichards(solver);
+    PFModule    *problem_saturation = ProblemSaturation(problem);
+    double      gravity = ProblemGravity(problem);
+    Vector      *saturation_in = GetSaturationRichards(solver);
+    Vector      *density = GetDensityRichards(solver);
+
+    /* no state damping for swc, see `update_parflow` */
+    ENKF2PF_analysis(saturation_in, zc_porosity, state_p, 1.0);
+
+    global_ptr_this_pf_module = problem_saturation;
+    SaturationToPressure(saturation_in, pressure_in, density, gravity, problem_data, CALCFCN, 1);
+    global_ptr_this_pf_module = solver;
   }
 
+  if(pf_updateflag == 3){
+    ENKF2PF_analysis(pressure_in, NULL, &state_p[enkf_subvecsize], 1.0);
+  }
 
-  /* check if frequency of parameter update is reached */
-  do_pupd = tstartcycle;
-  do_pupd = do_pupd % pf_freq_paramupdate;
-  do_pupd = !do_pupd;
+  /* update ghost cells for pressure */
+  handle = InitVectorUpdate(pressure_in, VectorUpdateAll);
+  FinalizeVectorUpdate(handle);
+}
 
-  /* update Ksat */
-  if(pf_paramupdate == 1 && do_pupd){
-    int ioff = pf_statevecsize - pf_paramvecsize;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Copy a state field from ParFlow for printing (`PF:zerocopy`).
+  @param    pressure   1: pressure (into `subvec_p`), 0: soil water content
+                       (into `subvec_sat`).
+  @return   Pointer to the filled array.
 
-    /* damping */
-    for(i=0;i<pf_paramvecsize;i++) pf_statevec[ioff+i] = log10(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log10(subvec_param[i]));
+  With `PF:zerocopy` there is no `pf_statevec`, so ensemble output and
+  statistics take a snapshot only when they are actually printed.
+ */
+/*--------------------------------------------------------------------------*/
+double *enkf_parflow_snapshot(int pressure) {
 
-    /* print ensemble statistics */
-    if(pf_paramprintstat){
-	printstat_param_parflow(&pf_statevec[ioff], "param.ksat",3);
-    }
+  if(pressure){
+    PF2ENKF(GetPressureRichards(solver), subvec_p);
+    return subvec_p;
+  }
 
-    /* backtransform updated K values */
-    for(i=0;i<pf_paramvecsize;i++) pf_statevec[ioff+i] = pow(10,pf_statevec[ioff+i]);
+  PF2ENKF_swc(GetSaturationRichards(solver), zc_porosity, subvec_sat);
+  return subvec_sat;
+}
 
-    /* print updated K values */
-    if(pf_paramprintensemble) enkf_printstatistics_pfb(&pf_statevec[ioff],"update.param.ksat",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
+void enkf_printvec(char *pre, char *suff, double *data, int dim) {
+  Vector *v=NULL;
+  if(dim==2){
+    v = vdummy_2d;
+  }else{
+    v = vdummy_3d;
   }
 
+  /* asynchronous or encoded output */
+  if(pf_output_queue > 0 || pf_output_precision != 64 || pf_output_compression != 0){
+    enkf_output_pfb(pre, suff, data, VectorGrid(v), dim);
+    return;
+  }
 
-  /* update Mannings */
-  if(pf_paramupdate == 2 && do_pupd){
-    int ioff = pf_statevecsize - pf_paramvecsize;
+  ENKF2PF(v, data);
 
-    /* damping */
-    for(i=0;i<pf_paramvecsize;i++) pf_statevec[ioff+i] = log10(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log10(subvec_param[i]));
+  WritePFBinary(pre, suff, v);
+}
 
-    /* print ensemble statistics */
-    if(pf_paramprintstat){
-	printstat_param_parflow(&pf_statevec[ioff], "param.mannings", 2);
-    }
+void enkf_printvec_ensemble(char *name, int cycle, double *data, int dim) {
+  Vector *v=NULL;
+  if(dim==2){
+    v = vdummy_2d;
+  }else{
+    v = vdummy_3d;
+  }
+  enkf_output_ensemble(name, cycle, data, VectorGrid(v), dim);
+}
 
-    /* backtransform updated mannings values */
-    for(i=0;i<pf_paramvecsize;i++) pf_statevec[ioff+i] = pow(10,pf_statevec[ioff+i]);
-
-    /* print mannings values */
-    if(pf_paramprintensemble){
-      char fprefix [200];
-      char fsuffix [10];
-      //sprintf(fprefix,"%s/%s.%s",outdir,pfinfile,"update.mannings");
-      sprintf(fprefix,"%s.%s",pfoutfile_ens,"update.mannings");
-      sprintf(fsuffix,"%05d",tstartcycle + stat_dumpoffset);
-      enkf_printmannings(fprefix,fsuffix);
-      /* TODO: This prints the Mannings values from the ParFlow
-	 ProblemData. However, at this point, the ParFlow ProblemData
-	 has not yet been updated. Thus, the name `update.mannings`
-	 may be confusing. */
+void enkf_printmannings(char *pre, char *suff){
+    ProblemData *problem_data = GetProblemDataRichards(solver);
+    if(pf_output_queue > 0 || pf_output_precision != 64 || pf_output_compression != 0){
+      enkf_output_vector(pre, suff, ProblemDataMannings(problem_data), 2);
+    }else{
+      WritePFBinary(pre,suff, ProblemDataMannings(problem_data));
     }
-  }
+}
 
-  /* update porosity */
-  if(pf_paramupdate == 3 && do_pupd){
-    int ioff = pf_statevecsize - pf_paramvecsize;
 
-    /* damping */
-    for(i=0;i<pf_paramvecsize;i++) pf_statevec[ioff+i] = subvec_param[i] + pf_dampfac_param * (pf_statevec[ioff+i] - subvec_param[i]);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    ParFlow Vectors stored in checkpoints.
+  @param    vectors   Vectors (output, at most ENKF_MAX_BLOCKS + 6).
+  @return   Number of Vectors.
 
-    /* print ensemble statistics */
-    if(pf_paramprintstat){
-      MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-      enkf_ensemblestatistics(&pf_statevec[ioff],subvec_mean,subvec_sd,pf_paramvecsize,comm_couple_c);
-      if(task_id == 1){
-        enkf_printstatistics_pfb(subvec_mean,"param.poro.mean", tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-        enkf_printstatistics_pfb(subvec_sd,"param.poro.sd", tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-      }
-    }
+  Pressure and saturation, the parameter blocks of the state vector
+  and the Vectors derived from them in `enkf_parflow_update_param`.
+ */
+/*--------------------------------------------------------------------------*/
+static int enkf_parflow_checkpoint_vectors(Vector **vectors) {
+	ProblemData *problem_data = GetProblemDataRichards(solver);
+	PFModule    *relPerm = GetPhaseRelPerm(solver);
+	PFModule    *sat     = GetSaturation(solver);
+	int         b, n = 0;
+
+	vectors[n++] = GetPressureRichards(solver);
+	vectors[n++] = GetSaturationRichards(solver);
+	for(b=pf_nstateblocks;b<pf_nblocks;b++){
+		Vector *v = pf_blocks[b].vector;
+		vectors[n++] = v;
+		if(v == ProblemDataPermeabilityX(problem_data)){
+			vectors[n++] = ProblemDataPermeabilityY(problem_data);
+			vectors[n++] = ProblemDataPermeabilityZ(problem_data);
+		}
+		if(v == PhaseRelPermGetAlpha(relPerm)) vectors[n++] = SaturationGetAlpha(sat);
+		if(v == PhaseRelPermGetN(relPerm)) vectors[n++] = SaturationGetN(sat);
+	}
+	return n;
+}
 
-    /* print updated porosity values */
-    if(pf_paramprintensemble) enkf_printstatistics_pfb(&pf_statevec[ioff], "update.param.poro", tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Wrapper buffers stored in checkpoints.
+  @param    arrays   Buffers (output).
+  @param    sizes    Sizes of the buffers (output).
+  @return   Number of buffers.
+ */
+/*--------------------------------------------------------------------------*/
+static int enkf_parflow_checkpoint_arrays(double **arrays, long long *sizes) {
+	int n = 0;
 
-  }
+	if(!pf_zerocopy){
+		arrays[n] = pf_statevec;
+		sizes[n++] = pf_statevecsize;
+	}
+	arrays[n] = subvec_p;
+	sizes[n++] = enkf_subvecsize;
+	arrays[n] = subvec_sat;
+	sizes[n++] = enkf_subvecsize;
+	arrays[n] = subvec_porosity;
+	sizes[n++] = enkf_subvecsize;
+	arrays[n] = subvec_param;
+	sizes[n++] = pf_paramvecsize;
+	arrays[n] = param_cache;
+	sizes[n++] = pf_paramvecsize;
+	return n;
+}
 
-  /* update van Genuchten */
-  if(pf_paramupdate == 4 && do_pupd){
-     int ioff = pf_statevecsize - pf_paramvecsize;
-
-      /* damping */
-      int alpha_counter = 0;
-      int n_counter = 0;
-      for(i=0;i<pf_paramvecsize;i++){
-        if((i%2)==0){
-          pf_statevec[ioff+i] = log(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log(subvec_param[i]));
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i];
-          alpha_counter++;
-        }else{
-          pf_statevec[ioff+i] = subvec_param[i] + pf_dampfac_param * (pf_statevec[ioff+i] - subvec_param[i]);
-          dat_n[n_counter] = pf_statevec[ioff+i];
-          n_counter++;
-         }
-      }
+static unsigned long long enkf_checkpoint_checksum(double *data, long long n) {
+	unsigned long long h = 14695981039346656037ULL;
+	long long i;
 
-      /* print ensemble statistics */
-      if(pf_paramprintstat){
-        MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-        enkf_ensemblestatistics(dat_alpha,subvec_mean,subvec_sd,pf_paramvecsize/2,comm_couple_c);
-        if(task_id==1){
-          enkf_printstatistics_pfb(subvec_mean,"param.alpha.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          enkf_printstatistics_pfb(subvec_sd,"param.alpha.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-        }
-        enkf_ensemblestatistics(dat_n,subvec_mean,subvec_sd,pf_paramvecsize/2,comm_couple_c);
-        if(task_id==1){
-          enkf_printstatistics_pfb(subvec_mean,"param.n.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          enkf_printstatistics_pfb(subvec_sd,"param.n.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-        }
-      }
+	for(i=0;i<n;i++){
+		unsigned long long w;
+		memcpy(&w, &data[i], sizeof(w));
+		h = (h ^ w) * 1099511628211ULL;
+	}
+	return h;
+}
 
-      /* backtransform updated alpha values */
-      alpha_counter = 0;
-      for(i=0;i<pf_paramvecsize;i++){
-          if((i%2)==0){
-              pf_statevec[ioff+i] = exp(pf_statevec[ioff+i]);
-              dat_alpha[alpha_counter] = pf_statevec[ioff+i];
-              alpha_counter++;
-          }
-      }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Layout of the checkpoint part of this PE.
+  @param    vectors   Vectors (output, see `enkf_parflow_checkpoint_vectors`).
+  @param    nvectors  Number of Vectors (output).
+  @param    nvalues   Number of values of this PE (output).
+  @return   File offset of the part of this PE.
 
-      /* print updated van Genuchten values */
-      if(pf_paramprintensemble){
-          enkf_printstatistics_pfb(dat_alpha,"update.param.alpha",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_n,"update.param.n",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-      }
-  }
+  Collective over the PEs of the ParFlow instance.
+ */
+/*--------------------------------------------------------------------------*/
+static MPI_Offset enkf_checkpoint_layout(Vector **vectors, int *nvectors, long long *nvalues) {
+	double    *arrays[6];
+	long long sizes[6];
+	long long bytes, offset = 0;
+	int       i, narrays, rank;
 
-  /* update hydraulic conductivity and porosity */
-  if(pf_paramupdate == 5 && do_pupd){
-      int ioff = pf_statevecsize - pf_paramvecsize;
-
-      /* damping */
-      int ksat_counter = 0;
-      int poro_counter = 0;
-      for(i=0;i<pf_paramvecsize;i++){
-          if((i%2)==0){
-              pf_statevec[ioff+i] = log10(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log10(subvec_param[i]));
-              dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-              ksat_counter++;
-          }else{
-              pf_statevec[ioff+i] = subvec_param[i] + pf_dampfac_param * (pf_statevec[ioff+i] - subvec_param[i]);
-              dat_poro[poro_counter] = pf_statevec[ioff+i];
-              poro_counter++;
-          }
-      }
+	*nvectors = enkf_parflow_checkpoint_vectors(vectors);
+	narrays = enkf_parflow_checkpoint_arrays(arrays, sizes);
 
-      /* print ensemble statistics */
-      if(pf_paramprintstat){
-          MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-          enkf_ensemblestatistics(dat_ksat,subvec_mean,subvec_sd,pf_paramvecsize/2,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.ksat.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.ksat.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_poro,subvec_mean,subvec_sd,pf_paramvecsize/2,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.poro.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.poro.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-      }
+	*nvalues = 0;
+	for(i=0;i<*nvectors;i++) *nvalues += enkf_getsubvectorsize(VectorGrid(vectors[i]));
+	for(i=0;i<narrays;i++) *nvalues += sizes[i];
 
-      /* backtransform updated ksat values */
-      ksat_counter = 0;
-      for(i=0;i<pf_paramvecsize;i++){
-          if((i%2)==0){
-	        pf_statevec[ioff+i] = pow(10,pf_statevec[ioff+i]);
-              dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-              ksat_counter++;
-          }
-      }
+	bytes = sizeof(enkf_checkpoint_header) + *nvalues * sizeof(double);
+	MPI_Comm_rank(amps_CommWorld, &rank);
+	MPI_Exscan(&bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, amps_CommWorld);
+	if(rank == 0) offset = 0;
 
-      /* print updated parameter values */
-      if(pf_paramprintensemble){
-          enkf_printstatistics_pfb(dat_ksat,"update.param.ksat",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_poro,"update.param.poro",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-      }
-  }
+	return (MPI_Offset) offset;
+}
 
-  /* update hydraulic conductivity and van Genuchten parameters */
-  if(pf_paramupdate == 6 && do_pupd){
-      int ioff = pf_statevecsize - pf_paramvecsize;
-
-      /* damping */
-      int ksat_counter = 0;
-      int alpha_counter = 0;
-      int n_counter = 0;
-      for(i=0;i<pf_paramvecsize;i=i+3){
-          pf_statevec[ioff+i] = log10(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log10(subvec_param[i]));
-          dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-          ksat_counter++;
-          pf_statevec[ioff+i+1] = log(subvec_param[i+1]) + pf_dampfac_param * (pf_statevec[ioff+i+1] - log(subvec_param[i+1]));
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i+1];
-          alpha_counter++;
-          pf_statevec[ioff+i+2] = subvec_param[i+2] + pf_dampfac_param * (pf_statevec[ioff+i+2] - subvec_param[i+2]);
-          dat_n[n_counter] = pf_statevec[ioff+i+2];
-          n_counter++;
-      }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Count of the MPI-IO call for the checkpoint part of this PE.
+  @param    nvalues   Number of values of this PE.
+  @return   Size of header and values in units of `MPI_DOUBLE`.
 
-      /* print ensemble statistics */
-      if(pf_paramprintstat){
-          MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-          enkf_ensemblestatistics(dat_ksat,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.ksat.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.ksat.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_alpha,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.alpha.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.alpha.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_n,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.n.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.n.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-      }
+  The header is a multiple of 8 bytes, so header and values are read and
+  written as doubles. This keeps the `int` count of MPI-IO valid up to
+  16 GiB per PE; larger parts abort with a message.
+ */
+/*--------------------------------------------------------------------------*/
+static int enkf_checkpoint_count(long long nvalues) {
+	long long count = (long long) (sizeof(enkf_checkpoint_header) / sizeof(double)) + nvalues;
 
-      /* backtransform updated ksat values */
-      ksat_counter = 0;
-      alpha_counter = 0;
-      for(i=0;i<pf_paramvecsize;i=i+3){
-          pf_statevec[ioff+i] = pow(10,pf_statevec[ioff+i]);
-          dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-          ksat_counter++;
-          pf_statevec[ioff+i+1] = exp(pf_statevec[ioff+i+1]);
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i+1];
-          alpha_counter++;
-      }
+	if(count > 2147483647LL){
+		printf("Error: enkf_checkpoint: checkpoint part of PE too large (%lld values), use more PEs\n", nvalues);
+		exit(1);
+	}
+	return (int) count;
+}
 
-      /* print updated parameter values */
-      if(pf_paramprintensemble){
-          enkf_printstatistics_pfb(dat_ksat,"update.param.ksat",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_alpha,"update.param.alpha",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_n,"update.param.n",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-      }
-  }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Write a checkpoint of this ensemble member (`PF:checkpoint`).
+
+  The checkpoint `<pfoutfile_ens>.checkpoint` holds for each PE a
+  header (cycle counters, sizes, checksum) followed by the ParFlow
+  pressure, saturation and parameter fields and the wrapper buffers
+  (`pf_statevec`, `subvec_*`). All PEs of the member write their part
+  with one collective MPI-IO call to a temporary file, which replaces
+  the previous checkpoint when complete.
+ */
+/*--------------------------------------------------------------------------*/
+void enkf_parflow_checkpoint() {
+	Vector    *vectors[ENKF_MAX_BLOCKS + 6];
+	double    *arrays[6];
+	long long sizes[6];
+	double    *buf, *p;
+	long long nvalues;
+	int       i, nvectors, narrays, rank, nranks, count;
+	char      filename[600], tmpname[610];
+	MPI_File  fh;
+	enkf_checkpoint_header header;
+	MPI_Offset offset = enkf_checkpoint_layout(vectors, &nvectors, &nvalues);
+
+	MPI_Comm_rank(amps_CommWorld, &rank);
+	MPI_Comm_size(amps_CommWorld, &nranks);
+	count = enkf_checkpoint_count(nvalues);
+
+	/* header and data of this PE in one buffer */
+	buf = (double *) malloc(sizeof(header) + nvalues * sizeof(double));
+	p = (double *) ((char *) buf + sizeof(header));
+	for(i=0;i<nvectors;i++){
+		enkf_field field;
+		enkf_field_set(&field, vectors[i], p, 1, ENKF_TRANSFORM_NONE);
+		enkf_gather(&field, 1);
+		p += enkf_getsubvectorsize(VectorGrid(vectors[i]));
+	}
+	narrays = enkf_parflow_checkpoint_arrays(arrays, sizes);
+	for(i=0;i<narrays;i++){
+		memcpy(p, arrays[i], sizes[i] * sizeof(double));
+		p += sizes[i];
+	}
 
-  /* update porosity and van Genuchten parameters */
-  if(pf_paramupdate == 7 && do_pupd){
-      int ioff = pf_statevecsize - pf_paramvecsize;
-
-      /* damping */
-      int poro_counter = 0;
-      int alpha_counter = 0;
-      int n_counter = 0;
-      for(i=0;i<pf_paramvecsize;i=i+3){
-          pf_statevec[ioff+i] = subvec_param[i] + pf_dampfac_param * (pf_statevec[ioff+i] - subvec_param[i]);
-          dat_poro[poro_counter] = pf_statevec[ioff+i];
-          poro_counter++;
-          pf_statevec[ioff+i+1] = log(subvec_param[i+1]) + pf_dampfac_param * (pf_statevec[ioff+i+1] - log(subvec_param[i+1]));
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i+1];
-          alpha_counter++;
-          pf_statevec[ioff+i+2] = subvec_param[i+2] + pf_dampfac_param * (pf_statevec[ioff+i+2] - subvec_param[i+2]);
-          dat_n[n_counter] = pf_statevec[ioff+i+2];
-          n_counter++;
-      }
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ENKF_CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.rank = rank;
+	header.nranks = nranks;
+	header.tstartcycle = tstartcycle;
+	header.t_start = t_start;
+	header.nvalues = nvalues;
+	header.checksum = enkf_checkpoint_checksum((double *) ((char *) buf + sizeof(header)), nvalues);
+	memcpy(buf, &header, sizeof(header));
+
+	sprintf(filename, "%s.checkpoint", pfoutfile_ens);
+	sprintf(tmpname, "%s.tmp", filename);
+	if(MPI_File_open(amps_CommWorld, tmpname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS){
+		printf("Error: enkf_parflow_checkpoint: cannot open %s\n", tmpname);
+		exit(1);
+	}
+	if(MPI_File_write_at_all(fh, offset, buf, count, MPI_DOUBLE, MPI_STATUS_IGNORE) != MPI_SUCCESS){
+		printf("Error: enkf_parflow_checkpoint: writing %s failed\n", tmpname);
+		exit(1);
+	}
+	MPI_File_close(&fh);
+	free(buf);
 
-      /* print ensemble statistics */
-      if(pf_paramprintstat){
-          MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-          enkf_ensemblestatistics(dat_poro,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.poro.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.poro.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_alpha,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.alpha.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.alpha.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_n,subvec_mean,subvec_sd,pf_paramvecsize/3,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.n.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.n.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-      }
+	/* replace the previous checkpoint */
+	if(rank == 0 && rename(tmpname, filename) != 0){
+		printf("Error: enkf_parflow_checkpoint: cannot rename %s\n", tmpname);
+		exit(1);
+	}
+	MPI_Barrier(amps_CommWorld);
 
-      /* backtransform updated ksat values */
-      alpha_counter = 0;
-      for(i=1;i<pf_paramvecsize;i=i+3){
-          pf_statevec[ioff+i] = exp(pf_statevec[ioff+i]);
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i];
-          alpha_counter++;
-      }
+	if(screen_wrapper > 1 && task_id == 1 && rank == 0){
+		printf("TSMP-PDAF-WRAPPER mype(w)=%5d: checkpoint written at cycle %d\n", mype_world, tstartcycle);
+	}
+}
 
-      /* print updated parameter values */
-      if(pf_paramprintensemble){
-          enkf_printstatistics_pfb(dat_poro,"update.param.poro",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_alpha,"update.param.alpha",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_n,"update.param.n",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-      }
-  }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Restore this ensemble member from its checkpoint (`PF:restart`).
+  @return   Number of cycles between `tstartcycle` and the cycle of the
+            checkpoint.
+
+  Called after `parflow_oasis_init`. Overwrites the ParFlow fields and
+  the wrapper buffers with the data of `enkf_parflow_checkpoint`. The
+  checkpoint must be written with the same number of PEs and the same
+  state vector setup; sizes and checksum are checked.
+ */
+/*--------------------------------------------------------------------------*/
+int enkf_parflow_restart() {
+	Vector    *vectors[ENKF_MAX_BLOCKS + 6];
+	double    *arrays[6];
+	long long sizes[6];
+	double    *buf, *p;
+	long long nvalues;
+	int       i, nvectors, narrays, rank, nranks, count;
+	char      filename[600];
+	MPI_File  fh;
+	enkf_checkpoint_header header;
+	MPI_Offset offset = enkf_checkpoint_layout(vectors, &nvectors, &nvalues);
+
+	MPI_Comm_rank(amps_CommWorld, &rank);
+	MPI_Comm_size(amps_CommWorld, &nranks);
+	count = enkf_checkpoint_count(nvalues);
+
+	sprintf(filename, "%s.checkpoint", pfoutfile_ens);
+	if(MPI_File_open(amps_CommWorld, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS){
+		printf("Error: enkf_parflow_restart: cannot open %s\n", filename);
+		exit(1);
+	}
+	buf = (double *) malloc(sizeof(header) + nvalues * sizeof(double));
+	if(MPI_File_read_at_all(fh, offset, buf, count, MPI_DOUBLE, MPI_STATUS_IGNORE) != MPI_SUCCESS){
+		printf("Error: enkf_parflow_restart: reading %s failed\n", filename);
+		exit(1);
+	}
+	MPI_File_close(&fh);
+
+	/* check header and data */
+	memcpy(&header, buf, sizeof(header));
+	p = (double *) ((char *) buf + sizeof(header));
+	if(memcmp(header.magic, ENKF_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+	   || header.rank != rank || header.nranks != nranks || header.nvalues != nvalues){
+		printf("Error: enkf_parflow_restart: %s does not match the setup of this run\n", filename);
+		exit(1);
+	}
+	if(header.tstartcycle < tstartcycle){
+		printf("Error: enkf_parflow_restart: checkpoint in %s (cycle %d) is before the start cycle %d\n", filename, header.tstartcycle, tstartcycle);
+		exit(1);
+	}
+	if(header.checksum != enkf_checkpoint_checksum(p, nvalues)){
+		printf("Error: enkf_parflow_restart: checksum error in %s (PE %d)\n", filename, rank);
+		exit(1);
+	}
 
-  /* update hydraulic conductivity, porosity and van Genuchten parameters */
-  if(pf_paramupdate == 8 && do_pupd){
-      int ioff = pf_statevecsize - pf_paramvecsize;
-
-      /* damping */
-      int ksat_counter = 0;
-      int poro_counter = 0;
-      int alpha_counter = 0;
-      int n_counter = 0;
-      for(i=0;i<pf_paramvecsize;i=i+4){
-          pf_statevec[ioff+i] = log10(subvec_param[i]) + pf_dampfac_param * (pf_statevec[ioff+i] - log10(subvec_param[i]));
-          dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-          ksat_counter++;
-          pf_statevec[ioff+i+1] = subvec_param[i+1] + pf_dampfac_param * (pf_statevec[ioff+i+1] - subvec_param[i+1]);
-          dat_poro[poro_counter] = pf_statevec[ioff+i+1];
-          poro_counter++;
-          pf_statevec[ioff+i+2] = log(subvec_param[i+2]) + pf_dampfac_param * (pf_statevec[ioff+i+2] - log(subvec_param[i+2]));
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i+2];
-          alpha_counter++;
-          pf_statevec[ioff+i+3] = subvec_param[i+3] + pf_dampfac_param * (pf_statevec[ioff+i+3] - subvec_param[i+3]);
-          dat_n[n_counter] = pf_statevec[ioff+i+3];
-          n_counter++;
-      }
+	/* ParFlow fields */
+	for(i=0;i<nvectors;i++){
+		enkf_field field;
+		enkf_field_set(&field, vectors[i], p, 1, ENKF_TRANSFORM_NONE);
+		enkf_scatter(&field, 1);
+		p += enkf_getsubvectorsize(VectorGrid(vectors[i]));
+	}
+	for(i=0;i<nvectors;i+=ENKF_MAX_UPDATE){
+		enkf_vector_update(&vectors[i], nvectors - i < ENKF_MAX_UPDATE ? nvectors - i : ENKF_MAX_UPDATE);
+	}
 
-      /* print ensemble statistics */
-      if(pf_paramprintstat){
-          MPI_Comm comm_couple_c = MPI_Comm_f2c(comm_couple);
-          enkf_ensemblestatistics(dat_ksat,subvec_mean,subvec_sd,pf_paramvecsize/4,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.ksat.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.ksat.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_poro,subvec_mean,subvec_sd,pf_paramvecsize/4,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.poro.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.poro.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_alpha,subvec_mean,subvec_sd,pf_paramvecsize/4,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.alpha.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.alpha.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-          enkf_ensemblestatistics(dat_n,subvec_mean,subvec_sd,pf_paramvecsize/4,comm_couple_c);
-          if(task_id==1){
-            enkf_printstatistics_pfb(subvec_mean,"param.n.mean",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-            enkf_printstatistics_pfb(subvec_sd,"param.n.sd",tstartcycle + stat_dumpoffset,pfoutfile_stat,3);
-          }
-      }
+	/* wrapper buffers */
+	narrays = enkf_parflow_checkpoint_arrays(arrays, sizes);
+	for(i=0;i<narrays;i++){
+		memcpy(arrays[i], p, sizes[i] * sizeof(double));
+		p += sizes[i];
+	}
+	free(buf);
 
-      /* backtransform updated ksat values */
-      ksat_counter = 0;
-      alpha_counter = 0;
-      for(i=0;i<pf_paramvecsize;i=i+4){
-          pf_statevec[ioff+i] = pow(10,pf_statevec[ioff+i]);
-          dat_ksat[ksat_counter] = pf_statevec[ioff+i];
-          ksat_counter++;
-          pf_statevec[ioff+i+2] = exp(pf_statevec[ioff+i+2]);
-          dat_alpha[alpha_counter] = pf_statevec[ioff+i+2];
-          alpha_counter++;
-      }
+	/* parameters and anisotropy factors from the restored fields */
+	param_dirty = 1;
+	aniso_initialized = 0;
 
-      /* Reset damping factors to original value */
-      if(is_dampfac_state_time_dependent){
-	pf_dampfac_state = pf_dampfac_state_tmp;
-      }
-      if(is_dampfac_param_time_dependent){
-	pf_dampfac_param = pf_dampfac_param_tmp;
-      }
+	return header.tstartcycle - tstartcycle;
+}
 
-      /* print updated parameter values */
-      if(pf_paramprintensemble){
-          enkf_printstatistics_pfb(dat_ksat,"update.param.ksat",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_poro,"update.param.poro",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_alpha,"update.param.alpha",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-          enkf_printstatistics_pfb(dat_n,"update.param.n",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
-      }
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Reset damping factors after a time-dependent damping factor
+            from the observation file was used.
+ */
+/*--------------------------------------------------------------------------*/
+static void enkf_reset_dampfac(double dampfac_state, double dampfac_param) {
+  if(is_dampfac_state_time_dependent){
+    pf_dampfac_state = dampfac_state;
+  }
+  if(is_dampfac_param_time_dependent){
+    pf_dampfac_param = dampfac_param;
   }
+}
 
+void update_parflow () {
+  int i;
+  VectorUpdateCommHandle *handle;
 
-  if(pf_paramupdate == 3 && do_pupd){
-    ProblemData *problem_data = GetProblemDataRichards(solver);
-    Vector      *porosity     = ProblemDataPorosity(problem_data);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-    /* update porosity */
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++){
-      subvec_param[j] = pf_statevec[i];
-      subvec_porosity[j] = pf_statevec[i];
-    }
+  int do_pupd=0;
 
-    ENKF2PF(porosity,subvec_param);
-    handle = InitVectorUpdate(porosity,VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
+  /* Update damping factors if set in observation file */
+  double pf_dampfac_state_tmp = pf_dampfac_state;
+  double pf_dampfac_param_tmp = pf_dampfac_param;
+  if(is_dampfac_state_time_dependent){
+    pf_dampfac_state = dampfac_state_time_dependent;
+  }
+  if(is_dampfac_param_time_dependent){
+    pf_dampfac_param = dampfac_param_time_dependent;
   }
 
-  /* hydraulic conductivity and porosity */
-  if(pf_paramupdate == 5 && do_pupd){
-    ProblemData * problem_data = GetProblemDataRichards(solver);
-    Vector            *perm_xx = ProblemDataPermeabilityX(problem_data);
-    Vector            *perm_yy = ProblemDataPermeabilityY(problem_data);
-    Vector            *perm_zz = ProblemDataPermeabilityZ(problem_data);
-    Vector       *porosity    = ProblemDataPorosity(problem_data);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
+  /* state damping (zero-copy: done in `enkf_parflow_distribute_state`) */
+  if(pf_updateflag == 1 && !pf_zerocopy){
+    if(pf_gwmasking == 0){
+	for(i=0;i<enkf_subvecsize;i++) pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
     }
-
-    int por_counter = 0;
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++){
-        subvec_param[j] = pf_statevec[i];
-        if((j%2)!=0){
-            subvec_porosity[por_counter] = pf_statevec[i];
-            por_counter++;
-        }
+    if(pf_gwmasking == 1){
+	/* Same as without groundwater mask, cells with groundwater will be handled in update_parflow */
+	for(i=0;i<enkf_subvecsize;i++) pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
     }
-
-    ENKF2PF_2P(perm_xx,porosity,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-    /* update perm_yy and perm_zz */
-    for(i=nshift,j=0,k=0;i<(nshift+pf_paramvecsize);i=i+2,j=j+2,k++){
-      if(pf_aniso_use_parflow == 1){
-	subvec_param[j] = pf_statevec[i] * arr_aniso_perm_yy[k];
-	subvec_param[j+1] = pf_statevec[i] * arr_aniso_perm_zz[k];
-      }else{
-	subvec_param[j] = pf_statevec[i] * pf_aniso_perm_y;
-	subvec_param[j+1] = pf_statevec[i] * pf_aniso_perm_z;
-      }
+    if(pf_gwmasking == 2){
+	/* Use pressures are saturation times porosity depending on mask */
+	for(i=0;i<enkf_subvecsize;i++){
+	  if(subvec_gwind[i] == 1.0){
+	    /* State damping factor always applies for Pressure */
+	    pf_statevec[i] = subvec_p[i] + pf_dampfac_state * (pf_statevec[i] - subvec_p[i]);
+	  }
+	  else if(subvec_gwind[i] == 0.0){
+	    if(pf_dampswitch_sm == 1){
+	      /* State damping applied to SM */
+	      pf_statevec[i] = subvec_sat[i] * subvec_porosity[i] + pf_dampfac_state * (pf_statevec[i] - subvec_sat[i] * subvec_porosity[i]);
+	    }
+	    else{
+	      /* No damping factor for SM */
+	      pf_statevec[i] = subvec_sat[i] * subvec_porosity[i] + (pf_statevec[i] - subvec_sat[i] * subvec_porosity[i]);
+	    }
+	  }
+	  else{
+	    printf("ERROR: pf_gwmasking = 2, but subvec_gwind is neither 0.0 nor 1.0\n");
+	    exit(1);
+	  }
+	}
     }
-
-    ENKF2PF_2P(perm_yy,perm_zz,subvec_param);
-    handle = InitVectorUpdate(perm_yy, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(perm_zz, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
   }
 
-  /* porosity and van Genuchten parameter */
-  if(pf_paramupdate == 7 && do_pupd){
-    ProblemData * problem_data = GetProblemDataRichards(solver);
-    Vector            *porosity = ProblemDataPorosity(problem_data);
-    PFModule *relPerm = GetPhaseRelPerm(solver);
-    Vector            *alpha = PhaseRelPermGetAlpha(relPerm);
-    Vector            *n = PhaseRelPermGetN(relPerm);
-    PFModule *sat     = GetSaturation(solver);
-    Vector            *alpha_sat = SaturationGetAlpha(sat);
-    Vector            *n_sat = SaturationGetN(sat);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
+  /* print updated ensemble */
+  if(pf_t_printensemble == tstartcycle || pf_t_printensemble < 0 ) {
+    if(pf_zerocopy){
+      if(pf_printensemble == 1) enkf_printensemble_pfb(enkf_parflow_snapshot(pf_updateflag != 2),"update",tstartcycle + stat_dumpoffset,3);
+    }else if(pf_updateflag == 3){
+      if(pf_printensemble == 1) enkf_printensemble_pfb(&pf_statevec[enkf_subvecsize],"update",tstartcycle + stat_dumpoffset,3);
     }else{
-      nshift = enkf_subvecsize;
-    }
-
-    int por_counter = 0;
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++){
-        subvec_param[j] = pf_statevec[i];
-        if((j%3)==0){
-            subvec_porosity[por_counter] = pf_statevec[i];
-            por_counter++;
-        }
+      if(pf_printensemble == 1) enkf_printensemble_pfb(&pf_statevec[0],"update",tstartcycle + stat_dumpoffset,3);
     }
-
-    ENKF2PF_3P(porosity,alpha,n,subvec_param);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    ENKF2PF_3P(porosity,alpha_sat,n_sat,subvec_param);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
   }
 
-  /* hydraulic conductivity, porosity and van Genuchten parameter */
-  if(pf_paramupdate == 8 && do_pupd){
-    ProblemData * problem_data = GetProblemDataRichards(solver);
-    Vector            *perm_xx = ProblemDataPermeabilityX(problem_data);
-    Vector            *perm_yy = ProblemDataPermeabilityY(problem_data);
-    Vector            *perm_zz = ProblemDataPermeabilityZ(problem_data);
-    Vector            *porosity = ProblemDataPorosity(problem_data);
-    PFModule *relPerm = GetPhaseRelPerm(solver);
-    Vector            *alpha = PhaseRelPermGetAlpha(relPerm);
-    Vector            *n = PhaseRelPermGetN(relPerm);
-    PFModule *sat     = GetSaturation(solver);
-    Vector            *alpha_sat = SaturationGetAlpha(sat);
-    Vector            *n_sat = SaturationGetN(sat);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-
-    int por_counter = 0;
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++){
-        subvec_param[j] = pf_statevec[i];
-        if((j%4)==1){
-            subvec_porosity[por_counter] = pf_statevec[i];
-            por_counter++;
-        }
-    }
 
-    ENKF2PF_4P(perm_xx,porosity,alpha,n,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    ENKF2PF_4P(perm_xx,porosity,alpha_sat,n_sat,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
+  /* check if frequency of parameter update is reached */
+  do_pupd = tstartcycle;
+  do_pupd = do_pupd % pf_freq_paramupdate;
+  do_pupd = !do_pupd;
 
-    /* update perm_yy and perm_zz*/
-    for(i=nshift,j=0,k=0;i<(nshift+pf_paramvecsize);i=i+4,j=j+4,k++){
-        subvec_param[j] = pf_statevec[i];
-	  if(pf_aniso_use_parflow == 1){
-	    subvec_param[j+1] = pf_statevec[i] * arr_aniso_perm_yy[k];
-	    subvec_param[j+2] = pf_statevec[i] * arr_aniso_perm_zz[k];
-	  }else{
-	    subvec_param[j+1] = pf_statevec[i] * pf_aniso_perm_y;
-	    subvec_param[j+2] = pf_statevec[i] * pf_aniso_perm_z;
-	  }
-        subvec_param[j+3] = pf_statevec[i+1];
-    }
+  /* update parameters before the state, if porosity is updated
+     (used in the conversion of soil water content) */
+  if(pf_paramupdate > 0 && do_pupd && param_writeback_first){
+    enkf_parflow_update_param(pf_statevecsize - pf_paramvecsize);
+  }
 
-    ENKF2PF_4P(perm_xx,perm_yy,perm_zz,porosity,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(porosity, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(perm_yy, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(perm_zz, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
+  /* zero-copy: state already written in `enkf_parflow_distribute_state` */
+  if(pf_zerocopy){
+    enkf_reset_dampfac(pf_dampfac_state_tmp, pf_dampfac_param_tmp);
+    return;
   }
 
   if(pf_olfmasking == 1 || pf_olfmasking == 3) mask_overlandcells();
@@ -2066,7 +2416,7 @@ void update_parflow () {
 
     /* groundwater masking using saturated cells only */
     if(pf_gwmasking == 1){
-      ENKF2PF_masked(pressure_in, pf_statevec,subvec_gwind);
+      ENKF2PF_indexed(pressure_in, pf_statevec, &gw_saturated);
     }
 
     /* groundwater masking using mixed state vector */
@@ -2079,8 +2429,11 @@ void update_parflow () {
       Vector *density       = GetDensityRichards(solver);
 
       /* first update swc cells from mixed state vector pf_statevec */
-      for(i=0;i<enkf_subvecsize;i++){
-        subvec_sat[i] = subvec_gwind[i]*subvec_sat[i] + (1.0-subvec_gwind[i])*pf_statevec[i]/subvec_porosity[i];
+      int r, l;
+      for(r=0;r<gw_unsaturated.nruns;r++){
+        for(l=gw_unsaturated.run_start[r];l<gw_unsaturated.run_start[r]+gw_unsaturated.run_len[r];l++){
+          subvec_sat[l] = pf_statevec[l]/subvec_porosity[l];
+        }
       }
       ENKF2PF(saturation_in,subvec_sat);
       global_ptr_this_pf_module = problem_saturation;
@@ -2089,7 +2442,7 @@ void update_parflow () {
       global_ptr_this_pf_module = solver;
 
       /* second update remaining pressures cells from mixed state vector pf_statevec */
-      ENKF2PF_masked(pressure_in,pf_statevec,subvec_gwind);
+      ENKF2PF_indexed(pressure_in, pf_statevec, &gw_saturated);
     }
 
     /* update ghost cells for pressure */
@@ -2134,7 +2487,7 @@ void update_parflow () {
 
     /* Add an option here for masked update */
     if(pf_gwmasking == 1){
-      ENKF2PF_masked(saturation_in, pf_statevec,subvec_gwind);
+      ENKF2PF_indexed(saturation_in, pf_statevec, &gw_saturated);
     }else{
       ENKF2PF(saturation_in, pf_statevec);
     }
@@ -2193,237 +2546,12 @@ void update_parflow () {
 
   }
 
-  if(pf_paramupdate == 1 && do_pupd){
-    ProblemData * problem_data = GetProblemDataRichards(solver);
-    Vector            *perm_xx = ProblemDataPermeabilityX(problem_data);
-    Vector            *perm_yy = ProblemDataPermeabilityY(problem_data);
-    Vector            *perm_zz = ProblemDataPermeabilityZ(problem_data);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-
-    /* River masking for permeability update */
-    if(pf_olfmasking_param == 1 || pf_olfmasking_param == 3){
-
-      int idepth;
-      int izero = 0;
-      /* ishift implements the index shift nshift in pf_statevec */
-      int ishift = nshift;
-
-      /* fast-forward counters to layer numer `pf_olfmasking_depth`
-	 below surface layer */
-      izero += nx_local*ny_local*(nz_local-pf_olfmasking_depth);
-      ishift += nx_local*ny_local*(nz_local-pf_olfmasking_depth);
-
-      /* mask updated parameter values in uppermost model layers */
-      for(idepth=0;idepth<pf_olfmasking_depth;idepth++){
-	for(i=0;i<ny_local;i++){
-	  for(j=0;j<nx_local;j++){
-	    if(pf_olfmasking == 1){
-	      pf_statevec[ishift] = subvec_param[izero];
-	    }
-	    else if(pf_olfmasking == 3){
-	      if(pf_updateflag == 1 || pf_updateflag == 3){
-		if(subvec_p[izero]>0.0) pf_statevec[ishift] = subvec_param[izero];
-	      }else{
-		printf("Error (update_parflow): pf_olfmasking_param = 3 requires pf_updateflag = 1 or 3\n");
-		exit(1);
-	      }
-	    }
-	    ishift++;
-	    izero++;
-	  }
-	}
-      }
-
-    }
-
-    /* update perm_xx */
-    for(i=nshift,j=0;i<(nshift+enkf_subvecsize);i++,j++)
-      subvec_param[j] = pf_statevec[i];
-
-    if(pf_gwmasking == 0){
-      ENKF2PF(perm_xx,subvec_param);
-    }
-    // hcp gmasking with param
-    if(pf_gwmasking == 1){
-//      printf("Kxx masked");
-      ENKF2PF_masked(perm_xx, subvec_param,subvec_gwind);
-    }
-    if(pf_gwmasking == 2){
-//      printf("Kxx masked");
-      ENKF2PF_masked(perm_xx, subvec_param,subvec_gwind);
-    }
-    // hcp fin
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-    /* update perm_yy */
-    for(i=nshift,j=0,k=0;i<(nshift+enkf_subvecsize);i++,j++,k++){
-
-      if(pf_aniso_use_parflow == 1){
-	subvec_param[j] = pf_statevec[i] * arr_aniso_perm_yy[k];
-      }else{
-	subvec_param[j] = pf_statevec[i] * pf_aniso_perm_y;
-      }
-    }
-
-    if(pf_gwmasking == 0){
-      ENKF2PF(perm_yy,subvec_param);
-    }
-    // hcp gmasking with param
-    if(pf_gwmasking == 1){
-//      printf("Kyy masked");
-      ENKF2PF_masked(perm_yy, subvec_param,subvec_gwind);
-    }
-    if(pf_gwmasking == 2){
-//      printf("Kyy masked");
-      ENKF2PF_masked(perm_yy, subvec_param,subvec_gwind);
-    }
-    // hcp fin
-    handle = InitVectorUpdate(perm_yy, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-    /* update perm_zz */
-    for(i=nshift,j=0,k=0;i<(nshift+enkf_subvecsize);i++,j++,k++){
-      if(pf_aniso_use_parflow == 1){
-	subvec_param[j] = pf_statevec[i] * arr_aniso_perm_zz[k];
-      }else{
-	subvec_param[j] = pf_statevec[i] * pf_aniso_perm_z;
-      }
-    }
-
-    if(pf_gwmasking == 0){
-      ENKF2PF(perm_zz,subvec_param);
-    }
-    // hcp gmasking with param
-    if(pf_gwmasking == 1){
-//      printf("Kzz masked");
-      ENKF2PF_masked(perm_zz, subvec_param,subvec_gwind);
-    }
-    if(pf_gwmasking == 2){
-//      printf("Kzz masked");
-      ENKF2PF_masked(perm_zz, subvec_param,subvec_gwind);
-    }
-    // hcp fin
-    handle = InitVectorUpdate(perm_zz, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-  }
-
-  if(pf_paramupdate == 2 && do_pupd){
-    ProblemData *problem_data = GetProblemDataRichards(solver);
-    Vector       *mannings    = ProblemDataMannings(problem_data);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-    /* update mannings */
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++)
-      subvec_param[j] = pf_statevec[i];
-
-    ENKF2PF(mannings,subvec_param);
-    handle = InitVectorUpdate(mannings, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-  }
-
-  /* van Genuchten */
-  if(pf_paramupdate == 4 && do_pupd){
-    PFModule *relPerm = GetPhaseRelPerm(solver);
-    Vector            *alpha = PhaseRelPermGetAlpha(relPerm);
-    Vector            *n = PhaseRelPermGetN(relPerm);
-    PFModule *sat     = GetSaturation(solver);
-    Vector            *alpha_sat = SaturationGetAlpha(sat);
-    Vector            *n_sat = SaturationGetN(sat);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++)
-      subvec_param[j] = pf_statevec[i];
-
-    ENKF2PF_2P(alpha,n,subvec_param);
-    handle = InitVectorUpdate(alpha, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    ENKF2PF_2P(alpha_sat,n_sat,subvec_param);
-    handle = InitVectorUpdate(alpha_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
+  /* update remaining parameters */
+  if(pf_paramupdate > 0 && do_pupd && !param_writeback_first){
+    enkf_parflow_update_param(pf_statevecsize - pf_paramvecsize);
   }
 
-  /* hydraulic conductivity and van Genuchten parameter */
-  if(pf_paramupdate == 6 && do_pupd){
-    ProblemData * problem_data = GetProblemDataRichards(solver);
-    Vector            *perm_xx = ProblemDataPermeabilityX(problem_data);
-    Vector            *perm_yy = ProblemDataPermeabilityY(problem_data);
-    Vector            *perm_zz = ProblemDataPermeabilityZ(problem_data);
-    PFModule *relPerm = GetPhaseRelPerm(solver);
-    Vector            *alpha = PhaseRelPermGetAlpha(relPerm);
-    Vector            *n = PhaseRelPermGetN(relPerm);
-    PFModule *sat     = GetSaturation(solver);
-    Vector            *alpha_sat = SaturationGetAlpha(sat);
-    Vector            *n_sat = SaturationGetN(sat);
-    int nshift = 0;
-    if(pf_updateflag == 3){
-      nshift = 2*enkf_subvecsize;
-    }else{
-      nshift = enkf_subvecsize;
-    }
-
-    for(i=nshift,j=0;i<(nshift+pf_paramvecsize);i++,j++){
-        subvec_param[j] = pf_statevec[i];
-    }
-
-    ENKF2PF_3P(perm_xx,alpha,n,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    ENKF2PF_3P(perm_xx,alpha_sat,n_sat,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(alpha_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(n_sat, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-    /* update perm_yy and perm_zz*/
-    for(i=nshift,j=0,k=0;i<(nshift+pf_paramvecsize);i=i+3,j=j+3,k++){
-        /* if((j%2)==0){ */
-            subvec_param[j] = pf_statevec[i];
-	    if(pf_aniso_use_parflow == 1){
-	      subvec_param[j+1] = pf_statevec[i] * arr_aniso_perm_yy[k];
-	      subvec_param[j+2] = pf_statevec[i] * arr_aniso_perm_zz[k];
-	    }else{
-	      subvec_param[j+1] = pf_statevec[i] * pf_aniso_perm_y;
-	      subvec_param[j+2] = pf_statevec[i] * pf_aniso_perm_z;
-	    }
-        /* } */
-    }
-
-    ENKF2PF_3P(perm_xx,perm_yy,perm_zz,subvec_param);
-    handle = InitVectorUpdate(perm_xx, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(perm_yy, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-    handle = InitVectorUpdate(perm_zz, VectorUpdateAll);
-    FinalizeVectorUpdate(handle);
-
-  }
+  enkf_reset_dampfac(pf_dampfac_state_tmp, pf_dampfac_param_tmp);
 
     /* print updated mannings values */
     //if(pf_paramupdate == 2){
@@ -2438,69 +2566,48 @@ void update_parflow () {
 
 void mask_overlandcells()
 {
-  int idepth;
-  int i,j,k;
-  int counter = 0;
+  int sg, i, start, end;
 
-  /* fast-forward counter to uppermost model layer (minus pf_olfmasking_depth) */
-  counter = nx_local*ny_local*(nz_local-pf_olfmasking_depth);
+  /* mask updated values in uppermost model layers, stored at the
+     end of the block of each subgrid */
+  for(sg=0;sg<enkf_nsubgrids;sg++){
+    enkf_subgrid_toplayers(&enkf_subgrids[sg], &start, &end);
 
-  /* mask updated values in uppermost model layers */
-  if(pf_updateflag == 1){
-    for(idepth=0;idepth<pf_olfmasking_depth;idepth++){
-      for(i=0;i<ny_local;i++){
-	for(j=0;j<nx_local;j++){
-	  if(pf_olfmasking == 1){
-	    pf_statevec[counter] = subvec_p[counter];
-	  }
-	  else if(pf_olfmasking == 3){
-	    if(subvec_p[counter]>0.0) pf_statevec[counter] = subvec_p[counter];
-	  }
-	  counter++;
+    if(pf_updateflag == 1){
+      for(i=start;i<end;i++){
+	if(pf_olfmasking == 1){
+	  pf_statevec[i] = subvec_p[i];
+	}
+	else if(pf_olfmasking == 3){
+	  if(subvec_p[i]>0.0) pf_statevec[i] = subvec_p[i];
 	}
       }
-    }
-    if(pf_gwmasking == 2){   //There are overland cells being unsat (by hcp)
-      counter = nx_local*ny_local*(nz_local-pf_olfmasking_depth);
-      for(idepth=0;idepth<pf_olfmasking_depth;idepth++){
-	for(i=0;i<ny_local;i++){
-	  for(j=0;j<nx_local;j++){
-	    if(subvec_gwind[counter] < 0.5){
-	      if(pf_olfmasking == 1){
-		pf_statevec[counter] = subvec_sat[counter]*subvec_porosity[counter];
-	      }
-	      else if(pf_olfmasking == 3){
-		if(subvec_p[counter]>0.0) pf_statevec[counter] = subvec_sat[counter]*subvec_porosity[counter];
-	      }
+      if(pf_gwmasking == 2){   //There are overland cells being unsat (by hcp)
+	for(i=start;i<end;i++){
+	  if(subvec_gwind[i] < 0.5){
+	    if(pf_olfmasking == 1){
+	      pf_statevec[i] = subvec_sat[i]*subvec_porosity[i];
+	    }
+	    else if(pf_olfmasking == 3){
+	      if(subvec_p[i]>0.0) pf_statevec[i] = subvec_sat[i]*subvec_porosity[i];
 	    }
-	    counter++;
 	  }
 	}
       }
     }
-  }
-  if(pf_updateflag == 2){
-    for (idepth=0;idepth<pf_olfmasking_depth;idepth++){
-      for(i=0;i<ny_local;i++){
-	for(j=0;j<nx_local;j++){
-	  pf_statevec[counter] = subvec_sat[counter]*subvec_porosity[counter];
-	  //if(condition on saturations) pf_statevec[counter] = subvec_sat[counter]*subvec_porosity[counter];
-	  counter++;
-	}
+    if(pf_updateflag == 2){
+      for(i=start;i<end;i++){
+	pf_statevec[i] = subvec_sat[i]*subvec_porosity[i];
+	//if(condition on saturations) pf_statevec[i] = subvec_sat[i]*subvec_porosity[i];
       }
     }
-  }
-  if(pf_updateflag == 3){
-    for (idepth=0;idepth<pf_olfmasking_depth;idepth++){
-      for(i=0;i<ny_local;i++){
-	for(j=0;j<nx_local;j++){
-	  if(pf_olfmasking == 1){
-	    pf_statevec[counter+enkf_subvecsize] = subvec_p[counter];
-	  }
-	  else if(pf_olfmasking == 3){
-	    if(subvec_p[counter]>0.0) pf_statevec[counter+enkf_subvecsize] = subvec_p[counter];
-	  }
-	  counter++;
+    if(pf_updateflag == 3){
+      for(i=start;i<end;i++){
+	if(pf_olfmasking == 1){
+	  pf_statevec[i+enkf_subvecsize] = subvec_p[i];
+	}
+	else if(pf_olfmasking == 3){
+	  if(subvec_p[i]>0.0) pf_statevec[i+enkf_subvecsize] = subvec_p[i];
 	}
       }
     }
@@ -2512,37 +2619,33 @@ void mask_overlandcells_river()
 {
   int i,j,idx;
 
-  Grid *grid = VectorGrid(vdummy_3d);
-  int sg;
-
-  ForSubgridI(sg, GridSubgrids(grid))
-  {
-    Subgrid *subgrid = GridSubgrid(grid, sg);
-
-    int ix = SubgridIX(subgrid);
-    int iy = SubgridIY(subgrid);
-    int iz = SubgridIZ(subgrid);
-
-    int nx = SubgridNX(subgrid);
-    int ny = SubgridNY(subgrid);
-    int nz = SubgridNZ(subgrid);
-
+  if(river_cells == NULL){
+    river_cells = (int*) malloc((nriverid * nz_glob + 1) * sizeof(int));
     for(i=0;i<nriverid;i++){
-      if(riveridx[i]>=ix && riveridx[i]<(ix+nx) && riveridy[i]>=iy && riveridy[i]<(iy+ny)){
-        for(j=iz;j<(iz+nz);j++){
-          idx = nx*ny*j + (riveridy[i]-iy)*nx + (riveridx[i]-ix);
-          if(pf_updateflag == 1) pf_statevec[idx] = subvec_p[idx];
-          if(pf_updateflag == 2) pf_statevec[idx] = subvec_sat[idx]*subvec_porosity[idx];
-          if(pf_updateflag == 3) pf_statevec[idx+enkf_subvecsize] = subvec_p[idx];
-        }
+      for(j=0;j<nz_glob;j++){
+        idx = enkf_subgrid_index(riveridx[i], riveridy[i], j);
+        if(idx >= 0) river_cells[nriver_cells++] = idx;
       }
     }
   }
+
+  for(i=0;i<nriver_cells;i++){
+    idx = river_cells[i];
+    if(pf_updateflag == 1) pf_statevec[idx] = subvec_p[idx];
+    if(pf_updateflag == 2) pf_statevec[idx] = subvec_sat[idx]*subvec_porosity[idx];
+    if(pf_updateflag == 3) pf_statevec[idx+enkf_subvecsize] = subvec_p[idx];
+  }
 }
 
 void init_n_domains_size(int* n_domains_p)
 {
   int nshift = 0;
+  /* local analysis domains are the columns of a single subgrid */
+  if(enkf_nsubgrids > 1){
+    printf("enkf_nsubgrids=%d\n",enkf_nsubgrids);
+    printf("Error: Localized filters require a single ParFlow subgrid per process.\n");
+    exit(1);
+  }
   /* state updates */
   // if(pf_updateflag == 1 || pf_updateflag == 2) {
     *n_domains_p = nx_local * ny_local;
@@ -2588,6 +2691,6 @@ void init_parf_l_size(int* dim_l)
 
 void print_update_pfb(){
   if(model == 1){
-    enkf_printstatistics_pfb(subvec_p,"update",tstartcycle + stat_dumpoffset,pfoutfile_ens,3);
+    enkf_printensemble_pfb(subvec_p,"update",tstartcycle + stat_dumpoffset,3);
   }
 }
@@ -48,6 +48,8 @@ extern int pf_olfmasking_param;
 extern int pf_olfmasking_depth;
 extern int pf_gwmasking;
 extern int pf_printgwmask;
+extern int pf_zerocopy;
+extern int pf_paramclamp;
 GLOBAL int *riveridx,*riveridy,nriverid;
 
 /* global double variables */
@@ -74,9 +76,96 @@ GLOBAL int COMM_model_pfl;
 
 /* variables for calculation of statistics */
 GLOBAL double *subvec_mean, *subvec_sd;
+GLOBAL int stat_precomputed; /* `subvec_mean`/`subvec_sd` of this cycle already computed */
 GLOBAL double *subvec_param_mean, *subvec_param_sd;
 extern int    comm_couple;  /* task_id; */
-GLOBAL double *dat_alpha, *dat_n, *dat_ksat, *dat_poro;
+
+/* subgrid of this rank: bottom-lower-left corner, size, index of
+   the first cell in the state arrays and index of the first x-row */
+typedef struct {
+  int ix, iy, iz;
+  int nx, ny, nz;
+  int offset;
+  int row;
+} enkf_subgrid;
+
+/* index list of a mask on the state arrays: runs of consecutive
+   active cells, split at x-rows. The runs of row `r` are
+   `run_start/run_len[row_ptr[r]..row_ptr[r+1]-1]`, `run_start` is
+   the index of the first cell in the state arrays. */
+typedef struct {
+  int nrows;
+  int nruns;
+  int *row_ptr;
+  int *run_start;
+  int *run_len;
+} enkf_mask;
+#define ENKF_MAX_GRIDS 4
+#define ENKF_MAX_UPDATE 8
+
+GLOBAL enkf_subgrid *enkf_subgrids;
+GLOBAL int enkf_nsubgrids;
+GLOBAL enkf_mask gw_saturated, gw_unsaturated; /* index lists of `subvec_gwind` */
+
+/* block of the state vector: one ParFlow field stored contiguously */
+typedef struct {
+  char   name[16];    /* name of the field in output files */
+  Vector *vector;     /* ParFlow Vector */
+  int    transform;   /* ENKF_TRANSFORM_* */
+  double *dampfac;    /* damping factor of the analysis increment */
+  int    offset;      /* index of the first cell in the state vector */
+  int    size;        /* number of cells */
+  int    dim;         /* 2: surface field, 3: subsurface field */
+  int    mask;        /* ENKF_MASK_* rules for the write-back */
+  double vmin, vmax;  /* clamping bounds (PF:paramclamp) */
+} enkf_block;
+#define ENKF_MAX_BLOCKS 6
+#define ENKF_MASK_NONE 0
+#define ENKF_MASK_GW   1
+#define ENKF_MASK_OLF  2
+
+/* state vector layout: model state blocks first, then parameters */
+GLOBAL enkf_block pf_blocks[ENKF_MAX_BLOCKS];
+GLOBAL int pf_nblocks;
+GLOBAL int pf_nstateblocks;
+
+/* checkpoint (`PF:checkpoint`): header of the part of each PE */
+#define ENKF_CHECKPOINT_MAGIC "PFCHKPT1"
+typedef struct {
+  char   magic[8];
+  int    rank;          /* PE in the ParFlow instance */
+  int    nranks;
+  int    tstartcycle;
+  int    unused;
+  double t_start;
+  long long nvalues;    /* number of values following the header */
+  unsigned long long checksum;
+} enkf_checkpoint_header;
+
+/* transforms between ParFlow values and state vector values */
+#define ENKF_TRANSFORM_NONE  0
+#define ENKF_TRANSFORM_LOG10 1
+#define ENKF_TRANSFORM_LOG   2
+
+/* descriptor of one field in gather/scatter between ParFlow Vectors
+   and state vector arrays */
+typedef struct {
+  Vector *vector;     /* ParFlow Vector */
+  double *state;      /* state array, first cell */
+  int    stride;      /* distance of consecutive cells in `state` */
+  int    transform;   /* ENKF_TRANSFORM_* */
+  double *raw;        /* gather: untransformed values (optional, same stride) */
+  Vector *product;    /* gather: multiplied, scatter: divided (optional) */
+  double *factor;     /* scatter: cell-wise factor (optional) */
+  double scale;       /* scatter: constant factor */
+  double *mask;       /* scatter: blending mask (optional) */
+  double *forecast;   /* scatter: transformed forecast, enables post-processing (optional) */
+  double dampfac;     /* scatter: damping factor of the analysis increment */
+  double *stat;       /* scatter: damped value for statistics (optional) */
+  double vmin, vmax;  /* scatter: clamping bounds */
+  double *keep;       /* scatter: 1.0 keeps the forecast `raw` (optional) */
+  enkf_mask *index;   /* scatter: write active cells only (optional) */
+} enkf_field;
 
 /* functions */
 void enkfparflowinit(int ac, char *av[],char *input_file);
@@ -84,19 +173,41 @@ void enkfparflowadvance(int tcycle, double current_time, double dt);
 void enkfparflowfinalize();
 void enkf_printvec(char *pre, char *suff, double *data, int dim);
 void enkf_printmannings(char *pre, char *suff);
+void enkf_printvec_ensemble(char *name, int cycle, double *data, int dim);
+void enkf_output_init(int size);
+void enkf_output_pfb(char *pre, char *suff, double *data, Grid *grid, int dim);
+void enkf_output_vector(char *pre, char *suff, Vector *vector, int dim);
+void enkf_output_ensemble(char *name, int cycle, double *data, Grid *grid, int dim);
+void enkf_output_flush();
+void enkf_output_finalize();
 void enkf_ensemblestatistics (double* dat, double* mean, double* var, int size, MPI_Comm comm);
 void parflow_oasis_init(double current_time, double dt);
 void init_idx_map_subvec2state(Vector *pf_vector);
 
+enkf_subgrid *enkf_subgrid_table(Grid *grid, int *nsubgrids);
+int  enkf_subgrid_index(int i, int j, int k);
+int  enkf_parflow_state_index(int idx);
+void enkf_subgrid_toplayers(enkf_subgrid *s, int *start, int *end);
+void enkf_vector_update(Vector **vectors, int nvectors);
+void enkf_mask_build(enkf_mask *mask, double *values, double active);
+void enkf_mask_free(enkf_mask *mask);
+void enkf_gather(enkf_field *fields, int nfields);
+void enkf_scatter(enkf_field *fields, int nfields);
+void enkf_field_set(enkf_field *field, Vector *pf_vector, double *state, int stride, int transform);
+void enkf_backtransform_row(double *v, int n, int transform);
+void enkf_parflow_init_blocks();
+int  enkf_parflow_paramfields(enkf_field *fields, double *state);
 void PF2ENKF(Vector *pf_vector, double *enkf_subvec);
-void PF2ENKF_2P(Vector *p1_vector, Vector *p2_vector, double *enkf_subvec);
-void PF2ENKF_3P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, double *enkf_subvec);
-void PF2ENKF_4P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, Vector *p4_vector, double *enkf_subvec);
 void ENKF2PF(Vector *pf_vector, double *enkf_subvec);
-void ENKF2PF_2P(Vector *p1_vector, Vector *p2_vector, double *enkf_subvec);
-void ENKF2PF_3P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, double *enkf_subvec);
-void ENKF2PF_4P(Vector *p1_vector, Vector *p2_vector, Vector *p3_vector, Vector *p4_vector, double *enkf_subvec);
 void ENKF2PF_masked(Vector *pf_vector, double *enkf_subvec, double *mask);
+void ENKF2PF_indexed(Vector *pf_vector, double *enkf_subvec, enkf_mask *mask);
+void PF2ENKF_swc(Vector *sat_vector, Vector *poro_vector, double *enkf_subvec);
+void ENKF2PF_analysis(Vector *pf_vector, Vector *poro_vector, double *enkf_subvec, double dampfac);
+void enkf_parflow_collect_state(double *state_p);
+void enkf_parflow_distribute_state(double *state_p);
+double *enkf_parflow_snapshot(int pressure);
+void enkf_parflow_checkpoint();
+int  enkf_parflow_restart();
 int  enkf_getsubvectorsize(Grid *grid);
 
 void update_parflow();
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Reader for the PFB output of TSMP-PDAF (`enkf_output.c`).
+
+Reads plain `*.pfb` and encoded `*.epfb` files
+(`PF:output_precision`, `PF:output_compression`), including the
+ensemble files of `PF:ensemble_output` with one image per member.
+
+Layout of an image, all numbers big-endian:
+
+  global header, 64 bytes:
+    x, y, z     3 x float64
+    nx, ny, nz  3 x int32
+    dx, dy, dz  3 x float64
+    nsubgrids   int32
+  per subgrid:
+    subgrid header, 36 bytes: ix, iy, iz, nx, ny, nz, rx, ry, rz (int32)
+    *.pfb:  nx*ny*nz float64, x fastest
+    *.epfb: encoding header, 32 bytes:
+              precision    int32  64, 32 or 16
+              compression  int32  0 or 1
+              nbytes       int64  size of the data following
+              offset       float64
+              scale        float64
+            data, nbytes bytes:
+              precision 64/32: float64/float32 values
+              precision 16: int16 q, value = offset + scale * (q + 32767)
+              compression 1: the value bytes are shuffled (all first
+              bytes, then all second bytes, ...) and deflated (zlib)
+
+`PF:ensemble_output = 1`: the images of all members follow each other.
+`PF:ensemble_output = 2`: each line of `<name>.ens.idx` is
+"record cycle offset size"; the record at `offset` holds the images of
+all members.
+
+Usage: read_epfb.py FILE [OFFSET [COUNT]] prints shape, min and max of
+each image.
+"""
+import struct
+import sys
+import zlib
+
+import numpy as np
+
+
+def read_image(f, offset=0, encoded=None):
+    """Read the image at `offset` of the open file `f`.
+
+    Returns the field as array (nz, ny, nx) and the offset behind the
+    image. `encoded` defaults to the file name ending in `.epfb`.
+    """
+    if encoded is None:
+        encoded = f.name.endswith(".epfb")
+    f.seek(offset)
+    x, y, z, nx, ny, nz, dx, dy, dz, nsubgrids = struct.unpack(">3d3i3di", f.read(64))
+    field = np.zeros((nz, ny, nx))
+    for _ in range(nsubgrids):
+        ix, iy, iz, snx, sny, snz = struct.unpack(">9i", f.read(36))[:6]
+        n = snx * sny * snz
+        if encoded:
+            precision, compression, nbytes, voff, vscale = struct.unpack(">iiqdd", f.read(32))
+            data = f.read(nbytes)
+            size = precision // 8
+            if compression:
+                shuffled = np.frombuffer(zlib.decompress(data), dtype=np.uint8)
+                data = shuffled.reshape(size, n).T.tobytes()
+            if precision == 64:
+                v = np.frombuffer(data, dtype=">f8")
+            elif precision == 32:
+                v = np.frombuffer(data, dtype=">f4").astype(np.float64)
+            else:
+                v = voff + vscale * (np.frombuffer(data, dtype=">i2").astype(np.float64) + 32767.0)
+        else:
+            v = np.frombuffer(f.read(8 * n), dtype=">f8")
+        if nz == 1:
+            iz = 0
+        field[iz:iz + snz, iy:iy + sny, ix:ix + snx] = v.reshape(snz, sny, snx)
+    return field, f.tell()
+
+
+def read_images(filename, offset=0, count=None):
+    """Read `count` images (all if None) starting at `offset`."""
+    images = []
+    with open(filename, "rb") as f:
+        f.seek(0, 2)
+        end = f.tell()
+        while offset < end and (count is None or len(images) < count):
+            field, offset = read_image(f, offset)
+            images.append(field)
+    return images
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    offset = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+    count = int(sys.argv[3]) if len(sys.argv) > 3 else None
+    for m, field in enumerate(read_images(sys.argv[1], offset, count)):
+        print(m, field.shape, field.min(), field.max())
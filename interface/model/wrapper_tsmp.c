@@ -69,9 +69,22 @@ void initialize_tsmp() {
     /* enkf_parflow.c */
     enkfparflowinit(argc,argv,pfinfile);
     parflow_oasis_init(t_start,(double)da_interval);
+    if(pf_restart) restart_cycles = enkf_parflow_restart();
 #endif
   }
 
+  /* restart from ParFlow checkpoint (ParFlow stand-alone only, see
+     read_enkfpar): continue at the cycle of the checkpoint */
+  if(pf_restart){
+    MPI_Allreduce(MPI_IN_PLACE,&restart_cycles,1,MPI_INT,MPI_MAX,MPI_COMM_WORLD);
+    t_start     += restart_cycles * (double)da_interval;
+    tstartcycle += restart_cycles;
+    total_steps -= restart_cycles;
+    if(mype_world == 0){
+      printf("TSMP-PDAF-WRAPPER mype(w)=%5d: restart from checkpoint at cycle %d\n", mype_world, tstartcycle);
+    }
+  }
+
   if(model == 2){
 #if defined COUP_OAS_COS
     /* enkf_cosmo.F90 */
@@ -83,6 +96,9 @@ void initialize_tsmp() {
 
 void finalize_tsmp() {
 
+  /* prefetch started by the last `next_observation_pdaf` */
+  obs_prefetch_wait();
+
   if(model == 0) {
 #if defined COUP_OAS_PFL || defined CLMSA || defined COUP_OAS_COS
     clm_finalize();
@@ -208,6 +224,15 @@ void update_tsmp(){
 #if (defined COUP_OAS_PFL || defined PARFLOW_STAND_ALONE)
   if(model == 1){
     update_parflow();
+
+    /* print ensemble statistics of the state (reduced during the
+       assimilation) and of the updated parameters */
+    printstat_parflow_finish();
+
+    /* write checkpoint */
+    if(pf_checkpoint > 0 && tstartcycle % pf_checkpoint == 0){
+      enkf_parflow_checkpoint();
+    }
   }
 #endif
 